@@ -0,0 +1,83 @@
+#include "BatchPlanner.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+class BatchPlannerImpl
+{
+public:
+    BatchPlannerImpl(const StreetMap* sm, bool snapToStreets, ThreadPool* pool);
+    void planAll(const vector<PlanJob>& jobs, vector<PlanOutcome>& outcomes, BatchStats& stats) const;
+private:
+    ThreadPool* m_pool;
+    vector<unique_ptr<DeliveryPlanner>> m_planners;     // one per pool slot
+};
+
+BatchPlannerImpl::BatchPlannerImpl(const StreetMap* sm, bool snapToStreets, ThreadPool* pool)
+: m_pool(pool != nullptr ? pool : &ThreadPool::shared())
+{
+    for (int slot = 0; slot < m_pool->size(); slot++)
+        m_planners.emplace_back(new DeliveryPlanner(sm, snapToStreets));
+}
+
+void BatchPlannerImpl::planAll(const vector<PlanJob>& jobs, vector<PlanOutcome>& outcomes,
+                               BatchStats& stats) const
+{
+    auto batchStart = chrono::steady_clock::now();
+    outcomes.assign(jobs.size(), PlanOutcome());
+
+    // Largest first; the sort is stable so equal jobs keep their order
+    vector<int> byWork(jobs.size());
+    for (size_t i = 0; i < byWork.size(); i++)
+        byWork[i] = static_cast<int>(i);
+    stable_sort(byWork.begin(), byWork.end(), [&jobs](int a, int b) {
+        return jobs[a].deliveries.size() > jobs[b].deliveries.size();
+    });
+
+    m_pool->run(static_cast<int>(jobs.size()), [&](int task, int slot) {
+        int i = byWork[task];
+        auto jobStart = chrono::steady_clock::now();
+        outcomes[i].result = m_planners[slot]->generateDeliveryPlan(
+            jobs[i].depot, jobs[i].deliveries, outcomes[i].commands, outcomes[i].distance);
+        outcomes[i].seconds = chrono::duration<double>(chrono::steady_clock::now() - jobStart).count();
+    });
+
+    stats = BatchStats();
+    stats.jobs = static_cast<int>(jobs.size());
+    stats.threads = m_pool->size();
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - batchStart).count();
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (outcomes[i].result == DELIVERY_SUCCESS)
+            stats.succeeded++;
+        stats.deliveries += jobs[i].deliveries.size();
+        stats.meanJobSeconds += outcomes[i].seconds;
+        stats.maxJobSeconds = max(stats.maxJobSeconds, outcomes[i].seconds);
+    }
+    if (stats.jobs > 0)
+        stats.meanJobSeconds /= stats.jobs;
+}
+
+//******************** BatchPlanner functions *********************************
+
+// These functions simply delegate to BatchPlannerImpl's functions.
+
+BatchPlanner::BatchPlanner(const StreetMap* sm, bool snapToStreets, ThreadPool* pool)
+{
+    m_impl = new BatchPlannerImpl(sm, snapToStreets, pool);
+}
+
+BatchPlanner::~BatchPlanner()
+{
+    delete m_impl;
+}
+
+void BatchPlanner::planAll(const vector<PlanJob>& jobs, vector<PlanOutcome>& outcomes,
+                           BatchStats& stats) const
+{
+    m_impl->planAll(jobs, outcomes, stats);
+}
@@ -0,0 +1,85 @@
+//
+//  BatchPlanner.h
+//  Goober-Eats
+//
+
+#ifndef BatchPlanner_h
+#define BatchPlanner_h
+
+#include "provided.h"
+#include <vector>
+
+class BatchPlannerImpl;
+class ThreadPool;
+
+// Plans many delivery manifests against one map at once. The StreetMap is
+// only ever read, so every job shares it; jobs are spread over a thread
+// pool, each pool thread reusing its own DeliveryPlanner from job to job.
+//
+// The pool hands each idle thread the next job not yet started, so a slow
+// job never holds up the ones behind it. Jobs are started largest first,
+// which keeps one big manifest from being left to run on its own at the
+// end of the batch.
+
+  // One manifest to plan
+struct PlanJob
+{
+    GeoCoord                     depot;
+    std::vector<DeliveryRequest> deliveries;
+};
+
+  // What generateDeliveryPlan gave for one job
+struct PlanOutcome
+{
+    PlanOutcome()
+     : result(NO_ROUTE), distance(0), seconds(0)
+    {}
+
+    DeliveryResult               result;
+    std::vector<DeliveryCommand> commands;
+    double                       distance;  // miles travelled
+    double                       seconds;   // wall-clock time planning it
+};
+
+  // Throughput of a whole batch
+struct BatchStats
+{
+    BatchStats()
+     : jobs(0), succeeded(0), deliveries(0), seconds(0), threads(0),
+       meanJobSeconds(0), maxJobSeconds(0)
+    {}
+
+    double jobsPerSecond() const
+    {
+        return seconds > 0 ? jobs / seconds : 0;
+    }
+
+    int    jobs;
+    int    succeeded;       // jobs whose result was DELIVERY_SUCCESS
+    size_t deliveries;      // across all jobs
+    double seconds;         // wall-clock time for the whole batch
+    int    threads;         // pool threads, counting the caller
+    double meanJobSeconds;
+    double maxJobSeconds;
+};
+
+class BatchPlanner
+{
+public:
+      // snapToStreets is passed on to each DeliveryPlanner. With no pool
+      // given, ThreadPool::shared() is used.
+    BatchPlanner(const StreetMap* sm, bool snapToStreets = false, ThreadPool* pool = nullptr);
+    ~BatchPlanner();
+
+      // Plan every job; outcomes[i] is for jobs[i]
+    void planAll(const std::vector<PlanJob>& jobs, std::vector<PlanOutcome>& outcomes,
+                 BatchStats& stats) const;
+
+      // We prevent a BatchPlanner object from being copied or assigned.
+    BatchPlanner(const BatchPlanner&) = delete;
+    BatchPlanner& operator=(const BatchPlanner&) = delete;
+private:
+    BatchPlannerImpl* m_impl;
+};
+
+#endif /* BatchPlanner_h */
@@ -0,0 +1,455 @@
+#include "ContractionHierarchy.h"
+#include <algorithm>
+#include <queue>
+#include <functional>
+#include <fstream>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+//******************** Hierarchy file layout **********************************
+
+// A hierarchy file is a fixed header followed by the payload: the node
+// ranks, the upward graph's offsets, its arcs, and then every arc with the
+// arcs it unpacks into. Like map snapshots, each array starts on an 8-byte
+// boundary and the payload is checksummed.
+
+namespace
+{
+    const char HIERARCHY_MAGIC[8] = { 'G', 'O', 'O', 'B', 'C', 'H', '\0', '\0' };
+    const uint32_t HIERARCHY_VERSION = 1;
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct HierarchyHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t nNodes;
+        uint64_t nArcs;
+        uint64_t nShortcuts;
+        uint64_t fingerprint;       // of the graph the hierarchy belongs to
+        uint64_t payloadSize;
+        uint64_t checksum;
+    };
+
+    uint64_t align8(uint64_t n)
+    {
+        return (n + 7) & ~uint64_t(7);
+    }
+
+    // Give up looking for a witness path after settling this many nodes
+    // and add the shortcut anyway. That costs a few needless shortcuts but
+    // never a wrong answer.
+    const int WITNESS_SETTLE_LIMIT = 500;
+}
+
+//******************** ContractionHierarchy functions *************************
+
+const ContractionHierarchy::ArcId ContractionHierarchy::NO_ARC;
+
+ContractionHierarchy::ContractionHierarchy()
+: m_fingerprint(0), m_nShortcuts(0)
+{
+}
+
+void ContractionHierarchy::build(const StreetGraph& g)
+{
+    int nNodes = g.nodeCount();
+
+    m_fingerprint = g.fingerprint();
+    m_nShortcuts = 0;
+    m_arcs.clear();
+    m_rank.assign(nNodes, 0);
+
+    // Arcs at each node that still lead to uncontracted nodes
+    vector<vector<ArcId>> adjacent(nNodes);
+
+    auto otherEnd = [this](ArcId arc, NodeId n)
+    {
+        return m_arcs[arc].a == n ? m_arcs[arc].b : m_arcs[arc].a;
+    };
+
+    // One arc per pair of neighbouring nodes, using the shortest edge
+    // between them in each direction
+    auto shortestEdge = [&g](NodeId from, NodeId to)
+    {
+        EdgeId best = SearchContext::NO_EDGE;
+        for (EdgeId e = g.firstEdge(from); e != g.endEdge(from); e++)
+        {
+            if (g.edgeTarget(e) == to && (best == SearchContext::NO_EDGE || g.edgeLength(e) < g.edgeLength(best)))
+                best = e;
+        }
+        return best;
+    };
+
+    for (NodeId u = 0; u < static_cast<NodeId>(nNodes); u++)
+    {
+        for (EdgeId e = g.firstEdge(u); e != g.endEdge(u); e++)
+        {
+            NodeId v = g.edgeTarget(e);
+            if (v <= u || shortestEdge(u, v) != e)
+                continue;
+
+            ArcId id = static_cast<ArcId>(m_arcs.size());
+            m_arcs.push_back(Arc{u, v, g.edgeLength(e), e, shortestEdge(v, u), NO_ARC, NO_ARC});
+            adjacent[u].push_back(id);
+            adjacent[v].push_back(id);
+        }
+    }
+
+    struct Neighbour
+    {
+        NodeId node;
+        ArcId arc;
+        double length;
+    };
+
+    struct Shortcut
+    {
+        int from;           // indexes into the neighbour list
+        int to;
+        double length;
+    };
+
+    vector<bool> contracted(nNodes, false);
+    vector<int> deletedNeighbours(nNodes, 0);
+    SearchContext witness;
+
+    // The uncontracted neighbours of v, each by its shortest arc
+    auto neighboursOf = [&](NodeId v, vector<Neighbour>& out)
+    {
+        out.clear();
+        for (ArcId arc : adjacent[v])
+        {
+            NodeId w = otherEnd(arc, v);
+            if (w == v || contracted[w])
+                continue;
+
+            auto it = find_if(out.begin(), out.end(), [w](const Neighbour& nb) { return nb.node == w; });
+            if (it == out.end())
+                out.push_back(Neighbour{w, arc, m_arcs[arc].length});
+            else if (m_arcs[arc].length < it->length)
+                *it = Neighbour{w, arc, m_arcs[arc].length};
+        }
+    };
+
+    // The shortcuts contracting v would need: one for each pair of
+    // neighbours with no path between them at least as short that avoids v
+    auto shortcutsFor = [&](NodeId v, const vector<Neighbour>& nbs, vector<Shortcut>& out)
+    {
+        out.clear();
+        for (int i = 0; i + 1 < static_cast<int>(nbs.size()); i++)
+        {
+            double maxVia = 0;
+            for (int j = i + 1; j < static_cast<int>(nbs.size()); j++)
+                maxVia = max(maxVia, nbs[i].length + nbs[j].length);
+
+            witness.begin(nNodes);
+            witness.relax(nbs[i].node, 0, StreetGraph::NO_NODE, NO_ARC, 0);
+            for (int settled = 0; !witness.empty() && settled < WITNESS_SETTLE_LIMIT; settled++)
+            {
+                if (witness.minKey() > maxVia)
+                    break;
+                NodeId x = witness.popMin();
+                double gx = witness.g(x);
+                for (ArcId arc : adjacent[x])
+                {
+                    NodeId y = otherEnd(arc, x);
+                    if (y == v || contracted[y])
+                        continue;
+                    double d = gx + m_arcs[arc].length;
+                    witness.relax(y, d, x, arc, d);
+                }
+            }
+
+            for (int j = i + 1; j < static_cast<int>(nbs.size()); j++)
+            {
+                double via = nbs[i].length + nbs[j].length;
+                if (!(witness.g(nbs[j].node) <= via))
+                    out.push_back(Shortcut{i, j, via});
+            }
+        }
+    };
+
+    // Contract the node that adds the fewest arcs overall, favouring nodes
+    // whose neighbours have not been contracted yet so the hierarchy stays
+    // even. Priorities only go stale upward, so they are rechecked lazily.
+    vector<Neighbour> nbs;
+    vector<Shortcut> shortcuts;
+    auto priorityOf = [&](NodeId v)
+    {
+        neighboursOf(v, nbs);
+        shortcutsFor(v, nbs, shortcuts);
+        return static_cast<int>(shortcuts.size()) - static_cast<int>(nbs.size()) + deletedNeighbours[v];
+    };
+
+    typedef pair<int, NodeId> Entry;
+    priority_queue<Entry, vector<Entry>, greater<Entry>> queue;
+    for (NodeId v = 0; v < static_cast<NodeId>(nNodes); v++)
+        queue.push(Entry(priorityOf(v), v));
+
+    uint32_t nextRank = 0;
+    while (!queue.empty())
+    {
+        NodeId v = queue.top().second;
+        queue.pop();
+        if (contracted[v])
+            continue;
+
+        // This also leaves v's neighbours and shortcuts in nbs and shortcuts
+        int priority = priorityOf(v);
+        if (!queue.empty() && priority > queue.top().first)
+        {
+            queue.push(Entry(priority, v));
+            continue;
+        }
+
+        for (const Shortcut& s : shortcuts)
+        {
+            ArcId id = static_cast<ArcId>(m_arcs.size());
+            NodeId a = nbs[s.from].node;
+            NodeId b = nbs[s.to].node;
+            m_arcs.push_back(Arc{a, b, s.length, SearchContext::NO_EDGE, SearchContext::NO_EDGE,
+                                 nbs[s.from].arc, nbs[s.to].arc});
+            adjacent[a].push_back(id);
+            adjacent[b].push_back(id);
+            m_nShortcuts++;
+        }
+
+        contracted[v] = true;
+        m_rank[v] = nextRank++;
+
+        for (const Neighbour& nb : nbs)
+        {
+            deletedNeighbours[nb.node]++;
+            vector<ArcId>& arcs = adjacent[nb.node];
+            arcs.erase(remove_if(arcs.begin(), arcs.end(),
+                                 [&](ArcId arc) { return otherEnd(arc, nb.node) == v; }),
+                       arcs.end());
+        }
+        vector<ArcId>().swap(adjacent[v]);
+    }
+
+    buildUpwardGraph();
+}
+
+void ContractionHierarchy::buildUpwardGraph()
+{
+    int nNodes = static_cast<int>(m_rank.size());
+
+    // Each arc is stored once, at whichever end was contracted first
+    m_upOffsets.assign(nNodes + 1, 0);
+    for (const Arc& arc : m_arcs)
+        m_upOffsets[(m_rank[arc.a] < m_rank[arc.b] ? arc.a : arc.b) + 1]++;
+    for (int n = 0; n < nNodes; n++)
+        m_upOffsets[n + 1] += m_upOffsets[n];
+
+    m_up.resize(m_arcs.size());
+    vector<uint32_t> next(m_upOffsets.begin(), m_upOffsets.end() - 1);
+    for (ArcId id = 0; id < m_arcs.size(); id++)
+    {
+        const Arc& arc = m_arcs[id];
+        bool aIsLower = m_rank[arc.a] < m_rank[arc.b];
+        NodeId lower = aIsLower ? arc.a : arc.b;
+        m_up[next[lower]++] = UpArc{aIsLower ? arc.b : arc.a, id, arc.length};
+    }
+}
+
+DeliveryResult ContractionHierarchy::route(NodeId source, NodeId target,
+                                           SearchContext& forward, SearchContext& backward,
+                                           vector<RouteStep>& path, int& nodesExpanded) const
+{
+    int nNodes = nodeCount();
+    nodesExpanded = 0;
+    forward.begin(nNodes);
+    backward.begin(nNodes);
+    forward.relax(source, 0, StreetGraph::NO_NODE, NO_ARC, 0);
+    backward.relax(target, 0, StreetGraph::NO_NODE, NO_ARC, 0);
+
+    double best = numeric_limits<double>::infinity();
+    NodeId meet = StreetGraph::NO_NODE;
+
+    // Both searches only climb, so neither can stop at the first meeting
+    // point; each runs until nothing left in it could beat the best so far
+    for (;;)
+    {
+        double forwardMin = forward.empty() ? numeric_limits<double>::infinity() : forward.minKey();
+        double backwardMin = backward.empty() ? numeric_limits<double>::infinity() : backward.minKey();
+        if (min(forwardMin, backwardMin) >= best)
+            break;
+
+        SearchContext& ctx = forwardMin <= backwardMin ? forward : backward;
+        SearchContext& other = forwardMin <= backwardMin ? backward : forward;
+
+        NodeId current = ctx.popMin();
+        nodesExpanded++;
+        double d = ctx.g(current);
+        if (other.reached(current) && d + other.g(current) < best)
+        {
+            best = d + other.g(current);
+            meet = current;
+        }
+
+        for (uint32_t i = m_upOffsets[current]; i != m_upOffsets[current + 1]; i++)
+        {
+            const UpArc& up = m_up[i];
+            ctx.relax(up.target, d + up.length, current, up.arc, d + up.length);
+        }
+    }
+
+    if (meet == StreetGraph::NO_NODE)
+        return NO_ROUTE;
+
+    path.clear();
+
+    // The forward half is found from the meeting point back to the source
+    vector<ArcId> climb;
+    for (NodeId n = meet; n != source; n = forward.parent(n))
+        climb.push_back(forward.parentEdge(n));
+    NodeId from = source;
+    for (auto it = climb.rbegin(); it != climb.rend(); it++)
+    {
+        unpack(*it, from, path);
+        from = m_arcs[*it].a == from ? m_arcs[*it].b : m_arcs[*it].a;
+    }
+
+    // The backward half already runs from the meeting point to the target
+    for (NodeId n = meet; n != target; n = backward.parent(n))
+        unpack(backward.parentEdge(n), n, path);
+
+    return DELIVERY_SUCCESS;
+}
+
+void ContractionHierarchy::unpack(ArcId id, NodeId from, vector<RouteStep>& path) const
+{
+    const Arc& arc = m_arcs[id];
+
+    if (arc.childA == NO_ARC)
+    {
+        EdgeId e = from == arc.a ? arc.edgeAB : arc.edgeBA;
+        path.push_back(RouteStep{from, e});
+        return;
+    }
+
+    const Arc& first = m_arcs[arc.childA];
+    NodeId middle = first.a == arc.a ? first.b : first.a;
+    if (from == arc.a)
+    {
+        unpack(arc.childA, arc.a, path);
+        unpack(arc.childB, middle, path);
+    }
+    else
+    {
+        unpack(arc.childB, arc.b, path);
+        unpack(arc.childA, middle, path);
+    }
+}
+
+bool ContractionHierarchy::save(const string& file) const
+{
+    static_assert(sizeof(Arc) == 32 && sizeof(UpArc) == 16, "hierarchy arcs must pack without padding");
+
+    uint64_t nNodes = m_rank.size();
+    uint64_t nArcs = m_arcs.size();
+    uint64_t rankBytes = align8(sizeof(uint32_t) * nNodes);
+    uint64_t offsetBytes = align8(sizeof(uint32_t) * (nNodes + 1));
+
+    vector<uint64_t> buffer((rankBytes + offsetBytes + (sizeof(UpArc) + sizeof(Arc)) * nArcs) / 8, 0);
+    char* payload = reinterpret_cast<char*>(buffer.data());
+    char* p = payload;
+    memcpy(p, m_rank.data(), sizeof(uint32_t) * nNodes);
+    p += rankBytes;
+    memcpy(p, m_upOffsets.data(), sizeof(uint32_t) * (nNodes + 1));
+    p += offsetBytes;
+    memcpy(p, m_up.data(), sizeof(UpArc) * nArcs);
+    p += sizeof(UpArc) * nArcs;
+    memcpy(p, m_arcs.data(), sizeof(Arc) * nArcs);
+
+    HierarchyHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HIERARCHY_MAGIC, sizeof(header.magic));
+    header.version = HIERARCHY_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.nNodes = nNodes;
+    header.nArcs = nArcs;
+    header.nShortcuts = m_nShortcuts;
+    header.fingerprint = m_fingerprint;
+    header.payloadSize = 8 * buffer.size();
+    header.checksum = StreetGraph::checksum(payload, header.payloadSize);
+
+    ofstream outfile(file, ios::binary | ios::trunc);
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(payload, header.payloadSize);
+    if (!outfile)
+    {
+        cerr << "Cannot write " << file << "!" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool ContractionHierarchy::load(const string& file, const StreetGraph& g)
+{
+    ifstream infile(file, ios::binary);
+    if (!infile)
+    {
+        cerr << "Cannot open " << file << "!" << endl;
+        return false;
+    }
+
+    HierarchyHeader header;
+    vector<uint64_t> buffer;
+    uint64_t rankBytes = 0;
+    uint64_t offsetBytes = 0;
+    const char* problem = nullptr;
+
+    if (!infile.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, HIERARCHY_MAGIC, sizeof(header.magic)) != 0)
+        problem = "not a contraction hierarchy";
+    else if (header.version != HIERARCHY_VERSION)
+        problem = "unsupported hierarchy version";
+    else if (header.byteOrder != BYTE_ORDER_MARK)
+        problem = "hierarchy was written on a machine with a different byte order";
+    else if (header.nNodes != static_cast<uint64_t>(g.nodeCount()) || header.fingerprint != g.fingerprint())
+        problem = "hierarchy was built for a different map";
+    else
+    {
+        rankBytes = align8(sizeof(uint32_t) * header.nNodes);
+        offsetBytes = align8(sizeof(uint32_t) * (header.nNodes + 1));
+        if (header.payloadSize != rankBytes + offsetBytes + (sizeof(UpArc) + sizeof(Arc)) * header.nArcs)
+            problem = "hierarchy has inconsistent sizes";
+        else
+        {
+            buffer.resize(header.payloadSize / 8);
+            if (!infile.read(reinterpret_cast<char*>(buffer.data()), header.payloadSize))
+                problem = "hierarchy is truncated";
+            else if (StreetGraph::checksum(reinterpret_cast<const char*>(buffer.data()), header.payloadSize) != header.checksum)
+                problem = "hierarchy checksum mismatch";
+        }
+    }
+
+    if (problem != nullptr)
+    {
+        cerr << file << ": " << problem << "!" << endl;
+        return false;
+    }
+
+    const char* p = reinterpret_cast<const char*>(buffer.data());
+    m_rank.resize(header.nNodes);
+    memcpy(m_rank.data(), p, sizeof(uint32_t) * header.nNodes);
+    p += rankBytes;
+    m_upOffsets.resize(header.nNodes + 1);
+    memcpy(m_upOffsets.data(), p, sizeof(uint32_t) * (header.nNodes + 1));
+    p += offsetBytes;
+    m_up.resize(header.nArcs);
+    memcpy(m_up.data(), p, sizeof(UpArc) * header.nArcs);
+    p += sizeof(UpArc) * header.nArcs;
+    m_arcs.resize(header.nArcs);
+    memcpy(m_arcs.data(), p, sizeof(Arc) * header.nArcs);
+
+    m_fingerprint = header.fingerprint;
+    m_nShortcuts = static_cast<int>(header.nShortcuts);
+    return true;
+}
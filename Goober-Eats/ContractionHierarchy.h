@@ -0,0 +1,102 @@
+//
+//  ContractionHierarchy.h
+//  Goober-Eats
+//
+
+#ifndef ContractionHierarchy_h
+#define ContractionHierarchy_h
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include "SearchContext.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// A contraction hierarchy over a StreetGraph, for answering point-to-point
+// queries while touching only a tiny part of the map.
+//
+// build() ranks the nodes and contracts them one at a time, lowest rank
+// first. Contracting a node removes it and, wherever the only shortest
+// path between two of its neighbours ran through it, adds a shortcut arc
+// between them. A query then searches from both ends using only arcs that
+// lead to higher-ranked nodes, and the two searches meet at the top of the
+// shortest path. Shortcuts remember the two arcs they replace, so a route
+// found this way unpacks back into the map's own street edges.
+//
+// Streets in a map go both ways with the same length, so arcs are
+// undirected and one upward graph serves both search directions.
+//
+// Building is slow (seconds for a city) and only has to happen when the
+// map changes, so a hierarchy is normally built once and saved. A saved
+// hierarchy records the fingerprint of the graph it was built for, and
+// load refuses to pair it with any other.
+
+class ContractionHierarchy
+{
+public:
+    typedef StreetGraph::NodeId NodeId;
+    typedef StreetGraph::EdgeId EdgeId;
+    typedef uint32_t ArcId;
+
+    static const ArcId NO_ARC = 0xFFFFFFFF;
+
+    ContractionHierarchy();
+
+    void build(const StreetGraph& g);
+
+    bool save(const std::string& file) const;
+    bool load(const std::string& file, const StreetGraph& g);
+
+    int nodeCount() const { return static_cast<int>(m_rank.size()); }
+    int arcCount() const { return static_cast<int>(m_arcs.size()); }
+    int shortcutCount() const { return m_nShortcuts; }
+
+    // Shortest path from source to target in the graph this hierarchy was
+    // built for, unpacked into that graph's edges. The two contexts hold the
+    // forward and backward search state, so callers can reuse them from
+    // query to query. nodesExpanded counts the nodes settled by both
+    // searches together.
+    DeliveryResult route(NodeId source, NodeId target,
+                         SearchContext& forward, SearchContext& backward,
+                         std::vector<RouteStep>& path, int& nodesExpanded) const;
+
+    ContractionHierarchy(const ContractionHierarchy&) = delete;
+    ContractionHierarchy& operator=(const ContractionHierarchy&) = delete;
+
+private:
+    // An original street edge or a shortcut between nodes a and b. For an
+    // original, edgeAB and edgeBA are the StreetGraph edges a -> b and
+    // b -> a. A shortcut instead runs over arc childA (a to the contracted
+    // node) then arc childB (that node to b).
+    struct Arc
+    {
+        NodeId a;
+        NodeId b;
+        double length;
+        EdgeId edgeAB;
+        EdgeId edgeBA;
+        ArcId childA;
+        ArcId childB;
+    };
+
+    // An arc seen from its lower-ranked end
+    struct UpArc
+    {
+        NodeId target;
+        ArcId arc;
+        double length;
+    };
+
+    uint64_t m_fingerprint;         // of the graph this was built for
+    int m_nShortcuts;
+    std::vector<uint32_t> m_rank;   // contraction order, indexed by NodeId
+    std::vector<uint32_t> m_upOffsets;
+    std::vector<UpArc> m_up;        // CSR, like StreetGraph's edges
+    std::vector<Arc> m_arcs;
+
+    void buildUpwardGraph();
+    void unpack(ArcId arc, NodeId from, std::vector<RouteStep>& path) const;
+};
+
+#endif /* ContractionHierarchy_h */
@@ -0,0 +1,132 @@
+#include "CrowDistance.h"
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CROW_DISTANCE_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+constexpr double CrowDistance::PI;
+constexpr double CrowDistance::DEGREES;
+constexpr double CrowDistance::BOUND_SCALE;
+constexpr double CrowDistance::BOUND_SLACK;
+
+CrowDistance::CrowDistance(double latitude, double longitude)
+: m_latitude(latitude), m_longitude(longitude),
+  m_lat(deg2rad(latitude)), m_lon(deg2rad(longitude))
+{
+    m_cos = cos(m_lat);
+    m_sinAbs = fabs(sin(m_lat));
+}
+
+void CrowDistance::miles(const double* lats, const double* lons, size_t n, double* out) const
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = miles(lats[i], lons[i]);
+}
+
+void CrowDistance::lowerBounds(const double* lats, const double* lons, size_t n, double* out) const
+{
+#ifdef CROW_DISTANCE_AVX2
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    if (hasAVX2)
+    {
+        lowerBoundsAVX2(lats, lons, n, out);
+        return;
+    }
+#endif
+    lowerBoundsScalar(lats, lons, n, out);
+}
+
+void CrowDistance::lowerBoundsScalar(const double* lats, const double* lons, size_t n, double* out) const
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = lowerBound(lats[i], lons[i]);
+}
+
+#ifdef CROW_DISTANCE_AVX2
+
+// The same arithmetic as lowerBound, in the same order and without fused
+// multiply-adds, four points at a time
+__attribute__((target("avx2")))
+void CrowDistance::lowerBoundsAVX2(const double* lats, const double* lons, size_t n, double* out) const
+{
+    const __m256d signBit = _mm256_set1_pd(-0.0);
+    const __m256d degrees = _mm256_set1_pd(DEGREES);
+    const __m256d latitude0 = _mm256_set1_pd(m_latitude);
+    const __m256d longitude0 = _mm256_set1_pd(m_longitude);
+    const __m256d halfTurn = _mm256_set1_pd(180);
+    const __m256d fullTurn = _mm256_set1_pd(360);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1);
+    const __m256d two = _mm256_set1_pd(2);
+    const __m256d six = _mm256_set1_pd(6);
+    const __m256d cos0 = _mm256_set1_pd(m_cos);
+    const __m256d sinAbs0 = _mm256_set1_pd(m_sinAbs);
+    const __m256d scale = _mm256_set1_pd(BOUND_SCALE);
+    const __m256d slack = _mm256_set1_pd(BOUND_SLACK);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d dLat = _mm256_andnot_pd(signBit, _mm256_sub_pd(_mm256_loadu_pd(lats + i), latitude0));
+        __m256d dLon = _mm256_andnot_pd(signBit, _mm256_sub_pd(_mm256_loadu_pd(lons + i), longitude0));
+        __m256d wrapped = _mm256_sub_pd(fullTurn, dLon);
+        dLon = _mm256_blendv_pd(dLon, wrapped, _mm256_cmp_pd(dLon, halfTurn, _CMP_GT_OQ));
+        dLat = _mm256_mul_pd(dLat, degrees);
+        dLon = _mm256_mul_pd(dLon, degrees);
+
+        __m256d a = _mm256_div_pd(dLat, two);
+        __m256d b = _mm256_div_pd(dLon, two);
+        __m256d sinA = _mm256_sub_pd(a, _mm256_div_pd(_mm256_mul_pd(_mm256_mul_pd(a, a), a), six));
+        __m256d sinB = _mm256_sub_pd(b, _mm256_div_pd(_mm256_mul_pd(_mm256_mul_pd(b, b), b), six));
+        __m256d cosLat = _mm256_sub_pd(_mm256_mul_pd(cos0, _mm256_sub_pd(one, _mm256_div_pd(_mm256_mul_pd(dLat, dLat), two))),
+                                       _mm256_mul_pd(sinAbs0, dLat));
+        cosLat = _mm256_blendv_pd(cosLat, zero, _mm256_cmp_pd(cosLat, zero, _CMP_LT_OQ));
+
+        __m256d h = _mm256_add_pd(_mm256_mul_pd(sinA, sinA),
+                                  _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(cos0, cosLat), sinB), sinB));
+        __m256d bound = _mm256_sub_pd(_mm256_mul_pd(scale, _mm256_sqrt_pd(h)), slack);
+        _mm256_storeu_pd(out + i, _mm256_blendv_pd(zero, bound, _mm256_cmp_pd(bound, zero, _CMP_GT_OQ)));
+    }
+
+    lowerBoundsScalar(lats + i, lons + i, n - i, out + i);
+}
+
+#else
+
+void CrowDistance::lowerBoundsAVX2(const double* lats, const double* lons, size_t n, double* out) const
+{
+    lowerBoundsScalar(lats, lons, n, out);
+}
+
+#endif
+
+double CrowDistance::pathMiles(const double* lats, const double* lons, size_t n)
+{
+    static const double earthRadiusKm = 6371.0;
+    const double milesPerKm = 1 / 1.609344;
+    double total = 0;
+    if (n < 2)
+        return total;
+
+    double latr = deg2rad(lats[0]);
+    double lonr = deg2rad(lons[0]);
+    double cosLat = cos(latr);
+    for (size_t i = 1; i < n; i++)
+    {
+        double nextLatr = deg2rad(lats[i]);
+        double nextLonr = deg2rad(lons[i]);
+        double nextCos = cos(nextLatr);
+        double u = sin((nextLatr - latr) / 2);
+        double v = sin((nextLonr - lonr) / 2);
+        total += 2.0 * earthRadiusKm * asin(sqrt(u * u + cosLat * nextCos * v * v)) * milesPerKm;
+
+        latr = nextLatr;
+        lonr = nextLonr;
+        cosLat = nextCos;
+    }
+    return total;
+}
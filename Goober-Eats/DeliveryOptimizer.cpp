@@ -1,48 +1,119 @@
 #include "provided.h"
+#include "DistanceMatrix.h"
+#include "CrowDistance.h"
+#include "TourOptimizer.h"
+#include "RouteSplitter.h"
+#include "ScheduleOptimizer.h"
+#include "TravelTimes.h"
+#include "ThreadPool.h"
 #include <vector>
 #include <random>
 #include <utility>
+#include <algorithm>
+#include <chrono>
+#include <limits>
 using namespace std;
 
 class DeliveryOptimizerImpl
 {
 public:
-    DeliveryOptimizerImpl(const StreetMap* sm);
+    DeliveryOptimizerImpl(const StreetMap* sm, const OptimizerOptions& options);
     ~DeliveryOptimizerImpl();
     void optimizeDeliveryOrder(
         const GeoCoord& depot,
         vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+    void optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        vector<DeliveryRequest>& deliveries,
+        double timeBudget,
+        double& oldTourDistance,
+        double& newTourDistance,
+        int& rounds) const;
+    DeliveryResult splitDeliveries(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const FleetOptions& fleet,
+        vector<vector<DeliveryRequest>>& routes,
+        double& totalDistance) const;
+    DeliveryResult scheduleDeliveries(
+        const GeoCoord& depot,
+        vector<DeliveryRequest>& deliveries,
+        const ScheduleOptions& options,
+        vector<StopTime>& times,
+        double& returnMinute) const;
 private:
     const StreetMap* sm;
-    double getCrowDistance(vector<DeliveryRequest> deliveries) const
+    OptimizerOptions m_options;
+    
+    // Fills cost with the n*n street distances between the depot (stop 0)
+    // and the deliveries, or with edgeCosts the totals of those along the
+    // cheapest routes. Returns BAD_COORD if any of them isn't on the map;
+    // if the searches don't finish by deadline, cost is left empty.
+    DeliveryResult streetCosts(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<double>& cost,
+        chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max(),
+        const vector<double>* edgeCosts = nullptr) const;
+    
+    // The same with straight line distances, which take no searching
+    void crowCosts(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<double>& cost) const;
+    
+    // Put deliveries in the order of a TourOptimizer visiting order
+    void reorder(vector<DeliveryRequest>& deliveries, const vector<int>& order) const;
+    
+    // Order one route's stops, given as indices into the n*n cost matrix,
+    // as optimizeDeliveryOrder would order them on their own. Returns the
+    // cost of the route.
+    double orderRoute(const vector<double>& cost, int n, vector<int>& route,
+                      default_random_engine& generator) const;
+    
+    bool solvesExactly(size_t nDeliveries) const
     {
-        double distance = 0;
+        return static_cast<int>(nDeliveries) <= min(m_options.exactMaxStops, TourOptimizer::MAX_EXACT_STOPS);
+    }
+    
+    double getCrowDistance(const vector<DeliveryRequest>& deliveries) const
+    {
+        vector<double> lats, lons;
+        lats.reserve(deliveries.size());
+        lons.reserve(deliveries.size());
         
-        for (int i = 0; i < deliveries.size() - 1; i++)
+        for (const DeliveryRequest& d : deliveries)
         {
-            distance += distanceEarthMiles(deliveries[i].location, deliveries[i+1].location);
+            lats.push_back(d.location.latitude);
+            lons.push_back(d.location.longitude);
         }
         
-        return distance;
+        return CrowDistance::pathMiles(lats.data(), lons.data(), lats.size());
+    }
+    
+    // A generator of its own for each call, so that optimizers on several
+    // threads never share one
+    default_random_engine newGenerator() const
+    {
+        random_device rd;
+        return default_random_engine(rd());
     }
     
     // Return a uniformly distributed random int from min to max, inclusive
-    int randInt(int min, int max) const
+    int randInt(default_random_engine& generator, int min, int max) const
     {
         if (max < min)
             std::swap(max, min);
-        static random_device rd;
-        static default_random_engine generator(rd());
         std::uniform_int_distribution<> distro(min, max);
         return distro(generator);
     }
     
 };
 
-DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
-: sm(sm)
+DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm, const OptimizerOptions& options)
+: sm(sm), m_options(options)
 {
 }
 
@@ -56,38 +127,321 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     double& oldCrowDistance,
     double& newCrowDistance) const
 {
-    // Create a PointToPointRouter so we can generate routes
-    PointToPointRouter pp(sm);
     oldCrowDistance = getCrowDistance(deliveries);
+    newCrowDistance = oldCrowDistance;
+    if (deliveries.size() < 2)
+        return;
     
-    DeliveryRequest temp("temp", depot); // Will be used to swap in vector
-    list<StreetSegment> dummyList;
+    vector<double> cost;
+    if (streetCosts(depot, deliveries, cost) != DELIVERY_SUCCESS)
+        return;
     
-    for (int i = 0; i < deliveries.size() - 1; i++)
+    // Small batches get the best order outright. Otherwise start from the
+    // nearest-neighbour order and improve the whole tour, including the
+    // legs from and back to the depot.
+    TourOptimizer tours(cost, static_cast<int>(deliveries.size()) + 1);
+    vector<int> order;
+    if (solvesExactly(deliveries.size()))
     {
-        double shortestDist = 0;
-        pp.generatePointToPointRoute(deliveries[i].location, deliveries[i+1].location, dummyList, shortestDist);
-        for (int j = i; j < deliveries.size(); j++)
+        tours.solveExact(order, m_options.exactParallel ? &ThreadPool::shared() : nullptr);
+    }
+    else
+    {
+        order = tours.nearestNeighbourOrder();
+        default_random_engine generator = newGenerator();
+        tours.optimize(order, m_options, [this, &generator](int min, int max) {
+            return randInt(generator, min, max);
+        });
+    }
+    
+    reorder(deliveries, order);
+    
+    newCrowDistance = getCrowDistance(deliveries);
+}
+
+void DeliveryOptimizerImpl::optimizeDeliveryOrder(
+    const GeoCoord& depot,
+    vector<DeliveryRequest>& deliveries,
+    double timeBudget,
+    double& oldTourDistance,
+    double& newTourDistance,
+    int& rounds) const
+{
+    auto start = chrono::steady_clock::now();
+    auto budget = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(timeBudget));
+    auto deadline = start + budget;
+    oldTourDistance = 0;
+    newTourDistance = 0;
+    rounds = 0;
+    if (deliveries.empty())
+        return;
+    
+    // On a big batch the searches alone can outlast a short budget. They
+    // get half of it, and if that isn't enough the other half goes on
+    // ordering the stops by straight line distance instead. A stop that
+    // isn't on the map leaves nothing to measure the order by.
+    vector<double> cost;
+    if (streetCosts(depot, deliveries, cost, start + budget / 2) != DELIVERY_SUCCESS)
+        return;
+    if (cost.empty())
+        crowCosts(depot, deliveries, cost);
+    
+    // The order we were given is the best so far until something beats it
+    int n = static_cast<int>(deliveries.size()) + 1;
+    TourOptimizer tours(cost, n);
+    vector<int> order;
+    for (int stop = 1; stop < n; stop++)
+        order.push_back(stop);
+    oldTourDistance = tours.tourCost(order);
+    newTourDistance = oldTourDistance;
+    if (deliveries.size() < 2 || chrono::steady_clock::now() >= deadline)
+        return;
+    
+    // The exact solver is only tried if it should finish in the time left,
+    // and gives up at the deadline all the same, leaving the order as it
+    // was for the heuristic search to make what it can of
+    double secondsLeft = chrono::duration<double>(deadline - chrono::steady_clock::now()).count();
+    ThreadPool* pool = m_options.exactParallel ? &ThreadPool::shared() : nullptr;
+    if (solvesExactly(deliveries.size()) &&
+        TourOptimizer::exactSeconds(static_cast<int>(deliveries.size())) <= secondsLeft &&
+        tours.solveExact(order, pool, deadline) < numeric_limits<double>::infinity())
+    {
+        rounds = 1;
+    }
+    else
+    {
+        vector<int> nearest = tours.nearestNeighbourOrder();
+        if (tours.tourCost(nearest) < oldTourDistance)
+            order.swap(nearest);
+        default_random_engine generator = newGenerator();
+        tours.optimizeUntil(order, m_options, deadline,
+                            [this, &generator](int min, int max) { return randInt(generator, min, max); },
+                            rounds);
+    }
+    
+    double tourDistance = tours.tourCost(order);
+    if (tourDistance < oldTourDistance)
+    {
+        reorder(deliveries, order);
+        newTourDistance = tourDistance;
+    }
+}
+
+DeliveryResult DeliveryOptimizerImpl::splitDeliveries(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const FleetOptions& fleet,
+    vector<vector<DeliveryRequest>>& routes,
+    double& totalDistance) const
+{
+    routes.clear();
+    totalDistance = 0;
+    if (deliveries.empty())
+        return DELIVERY_SUCCESS;
+    
+    // One matrix serves both the split and the ordering of every route
+    vector<double> cost;
+    if (streetCosts(depot, deliveries, cost) != DELIVERY_SUCCESS)
+        return BAD_COORD;
+    int n = static_cast<int>(deliveries.size()) + 1;
+    
+    vector<double> demand(1, 0);
+    for (const DeliveryRequest& d : deliveries)
+        demand.push_back(d.demand);
+    
+    RouteSplitter splitter(cost, n, demand, fleet.capacity);
+    vector<vector<int>> stopRoutes;
+    if (!splitter.split(fleet.vehicles, stopRoutes))
+        return NO_ROUTE;
+    
+    // The routes are independent now, so order them side by side. Each
+    // gets its own random number generator, seeded here in turn.
+    default_random_engine seeder = newGenerator();
+    vector<unsigned> seeds;
+    for (size_t r = 0; r < stopRoutes.size(); r++)
+        seeds.push_back(static_cast<unsigned>(randInt(seeder, 0, numeric_limits<int>::max())));
+    vector<double> routeCosts(stopRoutes.size());
+    ThreadPool::shared().run(static_cast<int>(stopRoutes.size()), [&](int r, int) {
+        default_random_engine generator(seeds[r]);
+        routeCosts[r] = orderRoute(cost, n, stopRoutes[r], generator);
+    });
+    
+    for (size_t r = 0; r < stopRoutes.size(); r++)
+    {
+        if (routeCosts[r] >= TourOptimizer::UNREACHABLE_COST)
         {
-            //double currDist = distanceEarthMiles(deliveries[i].location, deliveries[j].location);
-            double currDist = 0;
-            
-            pp.generatePointToPointRoute(deliveries[i].location, deliveries[j].location, dummyList, currDist);
-            
-            // if distance between jth delivery and ith delivery is less than what we currently have,
-            // swap i+1th delivery and jth delivery
-            if (currDist < shortestDist)
-            {
-                shortestDist = currDist;
-                temp = deliveries[j];
-                deliveries[j] = deliveries[i+1];
-                deliveries[i+1] = temp;
-            }
+            routes.clear();
+            totalDistance = 0;
+            return NO_ROUTE;
         }
         
+        // stopRoutes holds matrix indices, and delivery i is index i+1
+        routes.push_back(vector<DeliveryRequest>());
+        for (int stop : stopRoutes[r])
+            routes.back().push_back(deliveries[stop - 1]);
+        totalDistance += routeCosts[r];
     }
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryOptimizerImpl::scheduleDeliveries(
+    const GeoCoord& depot,
+    vector<DeliveryRequest>& deliveries,
+    const ScheduleOptions& options,
+    vector<StopTime>& times,
+    double& returnMinute) const
+{
+    auto start = chrono::steady_clock::now();
+    auto budget = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.timeBudget));
+    times.clear();
+    returnMinute = options.startMinute;
     
-    newCrowDistance = getCrowDistance(deliveries);
+    // No street can be driven at all at a speed that isn't above zero
+    if (!(options.defaultMph > 0))
+        return NO_ROUTE;
+    for (const auto& named : options.streetMph)
+    {
+        if (!(named.second > 0))
+            return NO_ROUTE;
+    }
+    
+    if (deliveries.empty())
+        return DELIVERY_SUCCESS;
+    
+    // Travel times along the quickest routes, which needn't be the
+    // shortest. As in the anytime mode, the searches get half the budget,
+    // and straight lines at the default speed stand in if that's too
+    // little.
+    TravelTimes speeds(sm->graph(), options);
+    vector<double> minutes;
+    if (streetCosts(depot, deliveries, minutes, start + budget / 2, &speeds.edgeMinutes()) != DELIVERY_SUCCESS)
+        return BAD_COORD;
+    if (minutes.empty())
+    {
+        crowCosts(depot, deliveries, minutes);
+        for (double& m : minutes)
+            m *= 60 / options.defaultMph;
+    }
+    
+    int n = static_cast<int>(deliveries.size()) + 1;
+    vector<double> earliest(1, 0);
+    vector<double> latest(1, 0);
+    for (const DeliveryRequest& d : deliveries)
+    {
+        earliest.push_back(d.earliest);
+        latest.push_back(d.latest);
+    }
+    
+    ScheduleOptimizer scheduler(minutes, n, earliest, latest, options.startMinute, options.serviceMinutes);
+    vector<int> order;
+    if (scheduler.optimize(order, start + budget) >= TourOptimizer::UNREACHABLE_COST)
+        return NO_ROUTE;
+    
+    reorder(deliveries, order);
+    returnMinute = scheduler.schedule(order, times);
+    return DELIVERY_SUCCESS;
+}
+
+double DeliveryOptimizerImpl::orderRoute(const vector<double>& cost, int n, vector<int>& route,
+                                         default_random_engine& generator) const
+{
+    // The route's own stops, with the depot again as stop 0
+    int m = static_cast<int>(route.size()) + 1;
+    vector<int> stops(1, 0);
+    stops.insert(stops.end(), route.begin(), route.end());
+    vector<double> routeCost(m * m);
+    for (int from = 0; from < m; from++)
+    {
+        for (int to = 0; to < m; to++)
+            routeCost[from * m + to] = cost[stops[from] * n + stops[to]];
+    }
+    
+    // Routes are already being ordered in parallel, so the exact solver
+    // keeps to its own thread
+    TourOptimizer tours(routeCost, m);
+    vector<int> order;
+    if (solvesExactly(route.size()))
+    {
+        tours.solveExact(order);
+    }
+    else
+    {
+        for (int stop = 1; stop < m; stop++)
+            order.push_back(stop);
+        tours.optimize(order, m_options, [this, &generator](int min, int max) {
+            return randInt(generator, min, max);
+        });
+    }
+    
+    for (size_t i = 0; i < order.size(); i++)
+        route[i] = stops[order[i]];
+    return tours.tourCost(order);
+}
+
+DeliveryResult DeliveryOptimizerImpl::streetCosts(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<double>& cost,
+    chrono::steady_clock::time_point deadline,
+    const vector<double>* edgeCosts) const
+{
+    // Street distances between every pair of stops, found with one search
+    // per stop. Index 0 is the depot and delivery i is index i+1.
+    vector<GeoCoord> stops;
+    stops.push_back(depot);
+    for (const DeliveryRequest& d : deliveries)
+        stops.push_back(d.location);
+    
+    cost.clear();
+    DistanceMatrix matrix(sm);
+    matrix.useEdgeCosts(edgeCosts);
+    if (matrix.compute(stops, false, deadline) != DELIVERY_SUCCESS)
+        return BAD_COORD;
+    if (!matrix.complete())
+        return DELIVERY_SUCCESS;
+    
+    // The cost of every leg, whether or not it has a route
+    int n = static_cast<int>(stops.size());
+    cost.assign(n * n, 0);
+    for (int from = 0; from < n; from++)
+    {
+        for (int to = 0; to < n; to++)
+        {
+            cost[from * n + to] = matrix.hasRoute(from, to) ? matrix.distance(from, to)
+                                                            : TourOptimizer::UNREACHABLE_COST;
+        }
+    }
+    return DELIVERY_SUCCESS;
+}
+
+void DeliveryOptimizerImpl::crowCosts(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<double>& cost) const
+{
+    vector<double> lats, lons;
+    lats.push_back(depot.latitude);
+    lons.push_back(depot.longitude);
+    for (const DeliveryRequest& d : deliveries)
+    {
+        lats.push_back(d.location.latitude);
+        lons.push_back(d.location.longitude);
+    }
+    
+    size_t n = lats.size();
+    cost.assign(n * n, 0);
+    for (size_t from = 0; from < n; from++)
+        CrowDistance(lats[from], lons[from]).miles(lats.data(), lons.data(), n, &cost[from * n]);
+}
+
+void DeliveryOptimizerImpl::reorder(vector<DeliveryRequest>& deliveries, const vector<int>& order) const
+{
+    // order holds matrix indices, and delivery i is index i+1
+    vector<DeliveryRequest> ordered;
+    ordered.reserve(deliveries.size());
+    for (int stop : order)
+        ordered.push_back(deliveries[stop - 1]);
+    deliveries.swap(ordered);
 }
 
 //******************** DeliveryOptimizer functions ****************************
@@ -95,9 +449,9 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 // These functions simply delegate to DeliveryOptimizerImpl's functions.
 // You probably don't want to change any of this code.
 
-DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm)
+DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm, const OptimizerOptions& options)
 {
-    m_impl = new DeliveryOptimizerImpl(sm);
+    m_impl = new DeliveryOptimizerImpl(sm, options);
 }
 
 DeliveryOptimizer::~DeliveryOptimizer()
@@ -113,3 +467,34 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 {
     return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
+
+void DeliveryOptimizer::optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        vector<DeliveryRequest>& deliveries,
+        double timeBudget,
+        double& oldTourDistance,
+        double& newTourDistance,
+        int& rounds) const
+{
+    return m_impl->optimizeDeliveryOrder(depot, deliveries, timeBudget, oldTourDistance, newTourDistance, rounds);
+}
+
+DeliveryResult DeliveryOptimizer::splitDeliveries(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const FleetOptions& fleet,
+        vector<vector<DeliveryRequest>>& routes,
+        double& totalDistance) const
+{
+    return m_impl->splitDeliveries(depot, deliveries, fleet, routes, totalDistance);
+}
+
+DeliveryResult DeliveryOptimizer::scheduleDeliveries(
+        const GeoCoord& depot,
+        vector<DeliveryRequest>& deliveries,
+        const ScheduleOptions& options,
+        vector<StopTime>& times,
+        double& returnMinute) const
+{
+    return m_impl->scheduleDeliveries(depot, deliveries, options, times, returnMinute);
+}
@@ -1,25 +1,75 @@
 #include "provided.h"
 #include <vector>
+
+#include "StreetGraph.h"
+#include "DistanceMatrix.h"
 using namespace std;
 
 class DeliveryPlannerImpl
 {
 public:
-    DeliveryPlannerImpl(const StreetMap* sm);
+    DeliveryPlannerImpl(const StreetMap* sm, bool snapToStreets);
     ~DeliveryPlannerImpl();
     DeliveryResult generateDeliveryPlan(
         const GeoCoord& depot,
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan) const;
+    DeliveryResult insertDeliveries(
+        DeliveryPlan& plan,
+        const vector<DeliveryRequest>& newDeliveries,
+        vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled) const;
 private:
+    typedef StreetGraph::EdgeId EdgeId;
+    
     const StreetMap* sm;
+    bool m_snapToStreets;
     
-    string getDirection(const StreetSegment& seg) const
+    DeliveryResult planRoute(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan) const;
+    
+    // Route one leg, from start to end, and turn it into commands, with a
+    // DELIVER command at the end if delivery isn't null
+    DeliveryResult planLeg(
+        const PointToPointRouter& pp,
+        const GeoCoord& start,
+        const GeoCoord& end,
+        const DeliveryRequest* delivery,
+        vector<DeliveryCommand>& legCommands,
+        double& legMiles) const;
+    
+    // Turn a path into proceed and turn commands, read straight from the
+    // graph's per-edge length, bearing and street tables
+    void appendCommands(const vector<RouteStep>& path, vector<DeliveryCommand>& commands) const;
+    
+    // Move gc onto the map if it isn't already there; false if no street
+    // is close enough
+    bool snapToStreet(GeoCoord& gc) const
     {
-        const string dir[9] {"east", "northeast", "north", "northwest", "west", "southwest", "south", "southeast", "east"};
+        StreetSegment seg;
+        GeoCoord point;
+        if (sm->graph()->nodeOf(gc) != StreetGraph::NO_NODE)
+            return true;
+        if (!sm->nearestPointOnStreet(gc, seg, point) ||
+            distanceEarthMiles(gc, point) > DeliveryPlanner::MAX_SNAP_MILES)
+            return false;
         
-        double angle = angleOfLine(seg);
+        // Routes run between segment ends, so take the nearer one
+        gc = distanceEarthMiles(point, seg.start) <= distanceEarthMiles(point, seg.end) ? seg.start : seg.end;
+        return true;
+    }
+    
+    // Compass direction of a bearing in degrees, as angleOfLine gives it
+    string getDirection(double angle) const
+    {
+        const string dir[9] {"east", "northeast", "north", "northwest", "west", "southwest", "south", "southeast", "east"};
         
         for (int i = 0; i < 9; i++)
         {
@@ -32,8 +82,8 @@ private:
     
 };
 
-DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
-: sm(sm)
+DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm, bool snapToStreets)
+: sm(sm), m_snapToStreets(snapToStreets)
 {
 }
 
@@ -46,161 +96,253 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     const vector<DeliveryRequest>& deliveries,
     vector<DeliveryCommand>& commands,
     double& totalDistanceTravelled) const
+{
+    DeliveryPlan plan;
+    DeliveryResult result = generateDeliveryPlan(depot, deliveries, plan);
+    if (result != DELIVERY_SUCCESS)
+        return result;
+    
+    plan.commands(commands);
+    totalDistanceTravelled = plan.totalDistance;
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryPlan& plan) const
+{
+    if (!m_snapToStreets)
+        return planRoute(depot, deliveries, plan);
+    
+    GeoCoord snappedDepot = depot;
+    vector<DeliveryRequest> snappedDeliveries(deliveries);
+    if (!snapToStreet(snappedDepot))
+        return BAD_COORD;
+    for (DeliveryRequest& d : snappedDeliveries)
+    {
+        if (!snapToStreet(d.location))
+            return BAD_COORD;
+    }
+    
+    return planRoute(snappedDepot, snappedDeliveries, plan);
+}
+
+DeliveryResult DeliveryPlannerImpl::planRoute(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryPlan& plan) const
 {
     DeliveryOptimizer opt(sm);
     double dummy = 0;
     vector<DeliveryRequest> optDeliveries(deliveries);
     opt.optimizeDeliveryOrder(depot, optDeliveries, dummy, dummy);
     
-    // Reset our commands vector
-    commands.clear();
+    // Reset our plan
+    plan = DeliveryPlan();
+    plan.depot = depot;
+    plan.deliveries = optDeliveries;
     
-    // Generate point-to-point routes between depot and successive delivery points
+    // Generate point-to-point paths between depot and successive delivery points
     PointToPointRouter pp(sm);
-    list<StreetSegment> route;
-    
     GeoCoord start = depot;
     
-    double distanceTravelled = 0;
-    totalDistanceTravelled = 0;
-    
-    for (auto p : optDeliveries)
+    for (const auto& p : optDeliveries)
     {
-        // Reset routeSegment and distanceTravelled
-        route.clear();
-        distanceTravelled = 0;
-        
-        DeliveryResult result = pp.generatePointToPointRoute(start, p.location, route, distanceTravelled);
+        plan.legCommands.push_back(vector<DeliveryCommand>());
+        plan.legMiles.push_back(0);
+        DeliveryResult result = planLeg(pp, start, p.location, &p, plan.legCommands.back(), plan.legMiles.back());
         
         if (result != DELIVERY_SUCCESS)
             return result;
         
-        // Iterate through completeRoute and produce DeliveryCommands
-        string currStreet = route.begin()->name;
-        string prevType = "start";
-        StreetSegment prevSeg;
-        for (auto seg : route)
+        plan.totalDistance += plan.legMiles.back();
+        start = p.location;
+    }
+    
+    // Return to depot from the last stop actually visited
+    plan.legCommands.push_back(vector<DeliveryCommand>());
+    plan.legMiles.push_back(0);
+    DeliveryResult result = planLeg(pp, start, depot, nullptr, plan.legCommands.back(), plan.legMiles.back());
+    
+    if (result != DELIVERY_SUCCESS)
+        return result;
+    
+    plan.totalDistance += plan.legMiles.back();
+    
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryPlannerImpl::planLeg(
+    const PointToPointRouter& pp,
+    const GeoCoord& start,
+    const GeoCoord& end,
+    const DeliveryRequest* delivery,
+    vector<DeliveryCommand>& legCommands,
+    double& legMiles) const
+{
+    vector<RouteStep> path;
+    DeliveryResult result = pp.generatePointToPointPath(start, end, path, legMiles);
+    
+    if (result != DELIVERY_SUCCESS)
+        return result;
+    
+    legCommands.clear();
+    appendCommands(path, legCommands);
+    
+    if (delivery != nullptr)
+    {
+        DeliveryCommand command;
+        command.initAsDeliverCommand(delivery->item);
+        legCommands.push_back(command);
+    }
+    
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryPlannerImpl::insertDeliveries(
+    DeliveryPlan& plan,
+    const vector<DeliveryRequest>& newDeliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled) const
+{
+    vector<DeliveryRequest> added(newDeliveries);
+    if (m_snapToStreets)
+    {
+        for (DeliveryRequest& d : added)
         {
-            DeliveryCommand command;
+            if (!snapToStreet(d.location))
+                return BAD_COORD;
+        }
+    }
+    
+    // Distances from each new delivery to every stop, with one search per
+    // new delivery. Streets go both ways with the same length, so they are
+    // the distances to it too. The new deliveries are points 0 .. k-1,
+    // then come the depot and the plan's deliveries.
+    int k = static_cast<int>(added.size());
+    vector<GeoCoord> points;
+    for (const DeliveryRequest& d : added)
+        points.push_back(d.location);
+    points.push_back(plan.depot);
+    for (const DeliveryRequest& d : plan.deliveries)
+        points.push_back(d.location);
+    
+    DistanceMatrix matrix(sm);
+    if (matrix.computeFrom(points, k) != DELIVERY_SUCCESS)
+        return BAD_COORD;
+    
+    // Work on a copy, so a failure part way leaves the plan untouched.
+    // pointOf maps each of its deliveries to its point.
+    DeliveryPlan updated(plan);
+    vector<int> pointOf;
+    for (size_t i = 0; i < updated.deliveries.size(); i++)
+        pointOf.push_back(k + 1 + static_cast<int>(i));
+    
+    PointToPointRouter pp(sm);
+    for (int a = 0; a < k; a++)
+    {
+        // Leg g runs from the stop before delivery g (the depot for g = 0)
+        // to delivery g (the depot again for the last leg)
+        int legs = static_cast<int>(updated.legMiles.size());
+        int best = -1;
+        double bestAdded = 0;
+        for (int g = 0; g < legs; g++)
+        {
+            int from = g > 0 ? pointOf[g - 1] : k;
+            int to = g + 1 < legs ? pointOf[g] : k;
+            if (!matrix.hasRoute(a, from) || !matrix.hasRoute(a, to))
+                continue;
             
-            // Always proceed on the first DeliveryCommand after leaving a start location
-            if (prevType == "start")
+            double extra = matrix.distance(a, from) + matrix.distance(a, to) - updated.legMiles[g];
+            if (best == -1 || extra < bestAdded)
             {
-                string direction = getDirection(seg);
-                double segDist = distanceEarthMiles(seg.start, seg.end);
-                command.initAsProceedCommand(direction, seg.name, segDist);
-                commands.push_back(command);
-                prevType = "proceed";
-            }
-            else
-            {
-                if (seg.name != currStreet)  // Different street
-                {
-                    // If we need to turn
-                    if (angleBetween2Lines(prevSeg, seg) >= 1 && angleBetween2Lines(prevSeg, seg) <= 359)
-                    {
-                            string direction = (angleBetween2Lines(prevSeg, seg) < 180) ? "left" : "right";
-                            command.initAsTurnCommand(direction, seg.name);
-                            commands.push_back(command);
-                            DeliveryCommand afterTurn;
-                            
-                            direction = getDirection(seg);
-                            double segDist = distanceEarthMiles(seg.start, seg.end);
-                            afterTurn.initAsProceedCommand(direction, seg.name, segDist);
-                            commands.push_back(afterTurn);
-                    }
-                    else
-                    {
-                        string direction = getDirection(seg);
-                        double segDist = distanceEarthMiles(seg.start, seg.end);
-                        command.initAsProceedCommand(direction, seg.name, segDist);
-                        commands.push_back(command);
-                        prevType = "proceed";
-                    }
-                }
-                else // We catch sequential proceeds on same street here
-                {
-                    command = commands.back();
-                    commands.pop_back();
-                    double segDist = distanceEarthMiles(seg.start, seg.end);
-                    command.increaseDistance(segDist);
-                    commands.push_back(command);
-                    
-                }
-                
-                prevSeg = seg;
-                currStreet = seg.name;
+                best = g;
+                bestAdded = extra;
             }
-            
         }
-        DeliveryCommand delivery;
-        delivery.initAsDeliverCommand(p.item);
-        commands.push_back(delivery);
         
-        totalDistanceTravelled += distanceTravelled;
-        start = p.location;
+        if (best == -1)
+            return NO_ROUTE;
+        
+        // Route the two legs that replace leg best, and nothing else
+        const GeoCoord& start = best > 0 ? updated.deliveries[best - 1].location : updated.depot;
+        const GeoCoord& end = best + 1 < legs ? updated.deliveries[best].location : updated.depot;
+        const DeliveryRequest* next = best + 1 < legs ? &updated.deliveries[best] : nullptr;
+        vector<DeliveryCommand> toNew, fromNew;
+        double toNewMiles = 0;
+        double fromNewMiles = 0;
+        DeliveryResult result = planLeg(pp, start, added[a].location, &added[a], toNew, toNewMiles);
+        if (result == DELIVERY_SUCCESS)
+            result = planLeg(pp, added[a].location, end, next, fromNew, fromNewMiles);
+        
+        if (result != DELIVERY_SUCCESS)
+            return result;
+        
+        updated.legCommands[best].swap(fromNew);
+        updated.legMiles[best] = fromNewMiles;
+        updated.legCommands.insert(updated.legCommands.begin() + best, toNew);
+        updated.legMiles.insert(updated.legMiles.begin() + best, toNewMiles);
+        updated.deliveries.insert(updated.deliveries.begin() + best, added[a]);
+        pointOf.insert(pointOf.begin() + best, a);
     }
     
-    // Return to depot. Same code as before.
-    route.clear();
-    distanceTravelled = 0;
-    pp.generatePointToPointRoute(deliveries.back().location, depot, route, distanceTravelled);
-    totalDistanceTravelled += distanceTravelled;
-    string currStreet = route.begin()->name;
-    string prevType = "start";
-    StreetSegment prevSeg;
-    for (auto seg : route)
+    updated.totalDistance = 0;
+    for (double miles : updated.legMiles)
+        updated.totalDistance += miles;
+    
+    plan = updated;
+    plan.commands(commands);
+    totalDistanceTravelled = plan.totalDistance;
+    return DELIVERY_SUCCESS;
+}
+
+void DeliveryPlannerImpl::appendCommands(const vector<RouteStep>& path, vector<DeliveryCommand>& commands) const
+{
+    const StreetGraph* g = sm->graph();
+    uint32_t prevStreet = 0;
+    double prevBearing = 0;
+    
+    for (size_t i = 0; i < path.size(); i++)
     {
-        DeliveryCommand command;
+        EdgeId e = path[i].edge;
+        uint32_t street = g->edgeStreet(e);
+        double bearing = g->edgeBearing(e);
         
-        // Repeated logic here :(
-        if (prevType == "start")
+        // We catch sequential proceeds on same street here. Streets are
+        // interned, so the same street always has the same ID.
+        if (i > 0 && street == prevStreet)
         {
-            string direction = getDirection(seg);
-            double segDist = distanceEarthMiles(seg.start, seg.end);
-            command.initAsProceedCommand(direction, seg.name, segDist);
-            commands.push_back(command);
-            prevType = "proceed";
+            commands.back().increaseDistance(g->edgeLength(e));
         }
         else
         {
-            if (seg.name != currStreet)
+            string name = g->streetName(street);
+            
+            // Always proceed on the first DeliveryCommand after leaving a
+            // start location; later ones may need a turn first
+            if (i > 0)
             {
-                if (angleBetween2Lines(prevSeg, seg) >= 1 && angleBetween2Lines(prevSeg, seg) <= 359)
-                {
-                    string direction = (angleBetween2Lines(prevSeg, seg) < 180) ? "left" : "right";
-                    command.initAsTurnCommand(direction, seg.name);
-                    commands.push_back(command);
-                    DeliveryCommand afterTurn;
-                        
-                    direction = getDirection(seg);
-                    double segDist = distanceEarthMiles(seg.start, seg.end);
-                    afterTurn.initAsProceedCommand(direction, seg.name, segDist);
-                    commands.push_back(afterTurn);
-                }
-                else
+                double turn = bearing - prevBearing;
+                if (turn < 0)
+                    turn += 360;
+                
+                if (turn >= 1 && turn <= 359)
                 {
-                    string direction = getDirection(seg);
-                    double segDist = distanceEarthMiles(seg.start, seg.end);
-                    command.initAsProceedCommand(direction, seg.name, segDist);
+                    DeliveryCommand command;
+                    command.initAsTurnCommand(turn < 180 ? "left" : "right", name);
                     commands.push_back(command);
-                    prevType = "proceed";
                 }
             }
-            else
-            {
-                command = commands.back();
-                commands.pop_back();
-                double segDist = distanceEarthMiles(seg.start, seg.end);
-                command.increaseDistance(segDist);
-                commands.push_back(command);
-                
-            }
-            prevSeg = seg;
-            currStreet = seg.name;
+            
+            DeliveryCommand command;
+            command.initAsProceedCommand(getDirection(bearing), name, g->edgeLength(e));
+            commands.push_back(command);
         }
+        
+        prevStreet = street;
+        prevBearing = bearing;
     }
-    return DELIVERY_SUCCESS;
 }
 
 //******************** DeliveryPlanner functions ******************************
@@ -208,9 +350,11 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 // These functions simply delegate to DeliveryPlannerImpl's functions.
 // You probably don't want to change any of this code.
 
-DeliveryPlanner::DeliveryPlanner(const StreetMap* sm)
+constexpr double DeliveryPlanner::MAX_SNAP_MILES;
+
+DeliveryPlanner::DeliveryPlanner(const StreetMap* sm, bool snapToStreets)
 {
-    m_impl = new DeliveryPlannerImpl(sm);
+    m_impl = new DeliveryPlannerImpl(sm, snapToStreets);
 }
 
 DeliveryPlanner::~DeliveryPlanner()
@@ -226,3 +370,20 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 {
     return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryPlan& plan) const
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, plan);
+}
+
+DeliveryResult DeliveryPlanner::insertDeliveries(
+    DeliveryPlan& plan,
+    const vector<DeliveryRequest>& newDeliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled) const
+{
+    return m_impl->insertDeliveries(plan, newDeliveries, commands, totalDistanceTravelled);
+}
@@ -0,0 +1,248 @@
+#include "DistanceMatrix.h"
+#include "StreetGraph.h"
+#include "SearchContext.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <list>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+namespace
+{
+    // Search state each thread reuses from search to search, whichever
+    // matrix the search is for, so that building a fresh matrix for every
+    // set of points allocates no search state once the threads are warmed up
+    thread_local SearchContext matrixSearch;
+}
+
+class DistanceMatrixImpl
+{
+public:
+    DistanceMatrixImpl(const StreetMap* sm, ThreadPool* pool);
+    ~DistanceMatrixImpl();
+    DeliveryResult compute(const vector<GeoCoord>& points, int nSources, bool keepRoutes,
+                           chrono::steady_clock::time_point deadline);
+    void useEdgeCosts(const vector<double>* edgeCosts) { m_edgeCosts = edgeCosts; }
+    int size() const { return m_n; }
+    bool complete() const { return !m_expired; }
+    double distance(int from, int to) const { return m_dist[from * m_n + to]; }
+    bool hasRoute(int from, int to) const { return distance(from, to) != NO_PATH; }
+    DeliveryResult route(int from, int to, list<StreetSegment>& route) const;
+
+private:
+    typedef StreetGraph::NodeId NodeId;
+    typedef StreetGraph::EdgeId EdgeId;
+
+    static constexpr double NO_PATH = numeric_limits<double>::infinity();
+
+    // How many nodes a search settles between looks at the clock
+    static const int CLOCK_CHECK_INTERVAL = 1024;
+
+    // One step of a kept route: the edge taken and the node it leaves from
+    struct Step
+    {
+        NodeId from;
+        EdgeId edge;
+    };
+
+    const StreetMap* sm;
+    ThreadPool* m_pool;
+    int m_n;
+    vector<NodeId> m_nodes;             // the node each point is at
+    vector<double> m_dist;              // m_n x m_n, one row per source
+    vector<vector<Step>> m_routes;      // same shape, empty unless keepRoutes
+
+    vector<bool> m_isTarget;
+    int m_nTargets;                     // distinct nodes among m_nodes
+    const vector<double>* m_edgeCosts;  // nullptr to go by edge length
+
+    chrono::steady_clock::time_point m_deadline;
+    atomic<bool> m_expired;             // set by the first search to see the deadline pass
+
+    void searchFrom(int source, bool keepRoutes, SearchContext& ctx);
+};
+
+constexpr double DistanceMatrixImpl::NO_PATH;
+const int DistanceMatrixImpl::CLOCK_CHECK_INTERVAL;
+
+DistanceMatrixImpl::DistanceMatrixImpl(const StreetMap* sm, ThreadPool* pool)
+: sm(sm), m_pool(pool != nullptr ? pool : &ThreadPool::shared()), m_n(0), m_nTargets(0),
+  m_edgeCosts(nullptr), m_expired(false)
+{
+}
+
+DistanceMatrixImpl::~DistanceMatrixImpl()
+{
+}
+
+DeliveryResult DistanceMatrixImpl::compute(const vector<GeoCoord>& points, int nSources, bool keepRoutes,
+                                           chrono::steady_clock::time_point deadline)
+{
+    const StreetGraph* g = sm->graph();
+
+    m_n = 0;
+    m_deadline = deadline;
+    m_expired = false;
+    m_nodes.clear();
+    m_routes.clear();
+
+    for (const GeoCoord& p : points)
+    {
+        NodeId n = g->nodeOf(p);
+        if (n == StreetGraph::NO_NODE)
+            return BAD_COORD;
+        m_nodes.push_back(n);
+    }
+
+    m_n = static_cast<int>(points.size());
+    m_dist.assign(m_n * m_n, NO_PATH);
+    if (keepRoutes)
+        m_routes.resize(m_n * m_n);
+
+    // Several points may share a node; the search only needs to reach it once
+    m_isTarget.assign(g->nodeCount(), false);
+    m_nTargets = 0;
+    for (NodeId n : m_nodes)
+    {
+        if (!m_isTarget[n])
+        {
+            m_isTarget[n] = true;
+            m_nTargets++;
+        }
+    }
+
+    // Each search writes only its own row, so they can run side by side
+    m_pool->run(min(nSources, m_n), [this, keepRoutes](int source, int)
+    {
+        searchFrom(source, keepRoutes, matrixSearch);
+    });
+
+    return DELIVERY_SUCCESS;
+}
+
+void DistanceMatrixImpl::searchFrom(int source, bool keepRoutes, SearchContext& ctx)
+{
+    const StreetGraph* g = sm->graph();
+
+    ctx.begin(g->nodeCount());
+    NodeId start = m_nodes[source];
+    ctx.relax(start, 0, StreetGraph::NO_NODE, SearchContext::NO_EDGE, 0);
+
+    // With no deadline there is no need to keep looking at the clock
+    bool timed = m_deadline != chrono::steady_clock::time_point::max();
+    int settled = 0;
+
+    int targetsLeft = m_nTargets;
+    while (!ctx.empty())
+    {
+        if (timed && ++settled % CLOCK_CHECK_INTERVAL == 0 &&
+            (m_expired || chrono::steady_clock::now() >= m_deadline))
+        {
+            m_expired = true;
+            return;
+        }
+
+        NodeId current = ctx.popMin();
+
+        // Once every point has been reached there is nothing left to learn
+        if (m_isTarget[current] && --targetsLeft == 0)
+            break;
+
+        double currentDist = ctx.g(current);
+        for (EdgeId e = g->firstEdge(current); e != g->endEdge(current); e++)
+        {
+            double d = currentDist + (m_edgeCosts != nullptr ? (*m_edgeCosts)[e] : g->edgeLength(e));
+            ctx.relax(g->edgeTarget(e), d, current, e, d);
+        }
+    }
+
+    for (int to = 0; to < m_n; to++)
+    {
+        NodeId target = m_nodes[to];
+        if (!ctx.closed(target))
+            continue;
+
+        m_dist[source * m_n + to] = ctx.g(target);
+
+        if (keepRoutes)
+        {
+            vector<Step>& steps = m_routes[source * m_n + to];
+            for (NodeId n = target; n != start; n = ctx.parent(n))
+                steps.push_back(Step{ctx.parent(n), ctx.parentEdge(n)});
+            reverse(steps.begin(), steps.end());
+        }
+    }
+}
+
+DeliveryResult DistanceMatrixImpl::route(int from, int to, list<StreetSegment>& route) const
+{
+    if (from < 0 || from >= m_n || to < 0 || to >= m_n || m_routes.empty())
+        return BAD_COORD;
+    if (!hasRoute(from, to))
+        return NO_ROUTE;
+
+    const StreetGraph* g = sm->graph();
+    route.clear();
+    for (const Step& s : m_routes[from * m_n + to])
+        route.push_back(g->edgeSegment(s.from, s.edge));
+
+    return DELIVERY_SUCCESS;
+}
+
+//******************** DistanceMatrix functions *******************************
+
+// These functions simply delegate to DistanceMatrixImpl's functions.
+
+DistanceMatrix::DistanceMatrix(const StreetMap* sm, ThreadPool* pool)
+{
+    m_impl = new DistanceMatrixImpl(sm, pool);
+}
+
+DistanceMatrix::~DistanceMatrix()
+{
+    delete m_impl;
+}
+
+DeliveryResult DistanceMatrix::compute(const vector<GeoCoord>& points, bool keepRoutes,
+                                       chrono::steady_clock::time_point deadline)
+{
+    return m_impl->compute(points, static_cast<int>(points.size()), keepRoutes, deadline);
+}
+
+DeliveryResult DistanceMatrix::computeFrom(const vector<GeoCoord>& points, int nSources, bool keepRoutes)
+{
+    return m_impl->compute(points, nSources, keepRoutes, chrono::steady_clock::time_point::max());
+}
+
+void DistanceMatrix::useEdgeCosts(const vector<double>* edgeCosts)
+{
+    m_impl->useEdgeCosts(edgeCosts);
+}
+
+int DistanceMatrix::size() const
+{
+    return m_impl->size();
+}
+
+bool DistanceMatrix::complete() const
+{
+    return m_impl->complete();
+}
+
+double DistanceMatrix::distance(int from, int to) const
+{
+    return m_impl->distance(from, to);
+}
+
+bool DistanceMatrix::hasRoute(int from, int to) const
+{
+    return m_impl->hasRoute(from, to);
+}
+
+DeliveryResult DistanceMatrix::route(int from, int to, list<StreetSegment>& route) const
+{
+    return m_impl->route(from, to, route);
+}
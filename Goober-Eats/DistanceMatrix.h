@@ -0,0 +1,75 @@
+//
+//  DistanceMatrix.h
+//  Goober-Eats
+//
+
+#ifndef DistanceMatrix_h
+#define DistanceMatrix_h
+
+#include "provided.h"
+#include <vector>
+#include <list>
+#include <chrono>
+
+class DistanceMatrixImpl;
+class ThreadPool;
+
+// Shortest street distances between every pair of a set of points, such as
+// a depot and its deliveries. Rather than one point-to-point search per
+// pair, it runs a single Dijkstra search from each point and stops it as
+// soon as every other point has been reached. The searches are spread over
+// a thread pool; each thread keeps its own search scratch space from one
+// search to the next, even across matrices, so a DistanceMatrix is cheap to
+// make afresh for each set of points.
+
+class DistanceMatrix
+{
+public:
+      // With no pool given, ThreadPool::shared() is used
+    DistanceMatrix(const StreetMap* sm, ThreadPool* pool = nullptr);
+    ~DistanceMatrix();
+
+      // Compute the distances between all pairs of points. Returns BAD_COORD
+      // if any point isn't on the map. If keepRoutes is true, the routes
+      // themselves are kept too, for route(). Searches still running at
+      // deadline give up, leaving the matrix incomplete.
+    DeliveryResult compute(const std::vector<GeoCoord>& points, bool keepRoutes = false,
+                           std::chrono::steady_clock::time_point deadline =
+                               std::chrono::steady_clock::time_point::max());
+
+      // compute, but only searching from the first nSources points, for
+      // when the distances from just a few points to the rest are wanted.
+      // Rows of the other points have no routes.
+    DeliveryResult computeFrom(const std::vector<GeoCoord>& points, int nSources,
+                               bool keepRoutes = false);
+
+      // Weigh each edge e by (*edgeCosts)[e], such as the minutes it takes
+      // to drive, rather than by its length in later computes, so that
+      // distance() gives totals of those instead of miles; nullptr goes
+      // back to lengths. edgeCosts must outlive the computes.
+    void useEdgeCosts(const std::vector<double>* edgeCosts);
+
+      // The number of points in the last compute
+    int size() const;
+
+      // False if the last compute ran out of time, in which case some of
+      // the pairs it says have no route may have one after all
+    bool complete() const;
+
+      // Distance in miles from points[from] to points[to], or infinity if
+      // there is no route between them
+    double distance(int from, int to) const;
+    bool hasRoute(int from, int to) const;
+
+      // The route from points[from] to points[to]; compute must have been
+      // called with keepRoutes
+    DeliveryResult route(int from, int to, std::list<StreetSegment>& route) const;
+
+      // We prevent a DistanceMatrix object from being copied or assigned.
+    DistanceMatrix(const DistanceMatrix&) = delete;
+    DistanceMatrix& operator=(const DistanceMatrix&) = delete;
+private:
+    DistanceMatrixImpl* m_impl;
+};
+
+#endif /* DistanceMatrix_h */
@@ -9,7 +9,9 @@
 #define ExpandableHashMap_h
 
 #include <vector>
-#include <list>
+#include <new>
+#include <utility>
+#include <cstddef>
 
 // ExpandableHashMap.h
 
@@ -20,169 +22,259 @@ public:
     ExpandableHashMap(double maximumLoadFactor = 0.5);
     ~ExpandableHashMap();
     void reset(); // resets the hashmap back to 8 buckets, deletes all items
-    int size() const;
+    int size() const; // number of associations
     void associate(const KeyType& key, const ValueType& value);
-    
+
+    // If key has no value yet, construct one in place from args.
+    // Either way, return a pointer to key's value.
+    template<typename... Args>
+    ValueType* emplace(const KeyType& key, Args&&... args);
+
+    // Make room for n associations so that adding them won't rehash
+    void reserve(int n);
+
     // for a map that can't be modified, return a pointer to const ValueType
     const ValueType* find(const KeyType& key) const;
-    
+
     // for a modifiable map, return a pointer to modifiable ValueType
     ValueType* find(const KeyType& key)
     {
         return const_cast<ValueType*>(const_cast<const ExpandableHashMap*>(this)->find(key));
     }
-    
+
+    // Pointers returned by find and emplace are only good until the next
+    // association is added, since adding one may move others.
+
     // C++11 syntax for preventing copying and assignment
     ExpandableHashMap(const ExpandableHashMap&) = delete;
     ExpandableHashMap& operator=(const ExpandableHashMap&) = delete;
-    
+
 private:
     struct Node
     {
         KeyType key;
         ValueType val;
-        
-        Node(KeyType key, ValueType value) : key(key), val(value) {}
+
+        template<typename... Args>
+        Node(const KeyType& key, Args&&... args) : key(key), val(std::forward<Args>(args)...) {}
+    };
+
+    // Buckets use open addressing with Robin Hood probing. Each bucket has a
+    // Meta entry: dist is 0 if the bucket is empty, otherwise one more than
+    // how far its Node sits past the bucket its hash maps to. Nodes live in
+    // raw storage and are only constructed in full buckets.
+    struct Meta
+    {
+        unsigned int hash;
+        unsigned int dist;
     };
-    
-    std::vector<std::list<Node>*> myHash;
+
+    std::vector<Meta> myMeta;
+    Node* myNodes;
     double maxLoadFactor;
     int nNodes;
-    
+
+    static Node* allocateNodes(std::size_t nBuckets);
+    void destroyNodes();
+    int findIndex(const KeyType& key, unsigned int h) const;
+    template<typename... Args>
+    Node* insertNew(unsigned int h, Args&&... nodeArgs);
+    void rehash(std::size_t nBuckets);
     void expand();
 };
 
 template<typename KeyType, typename ValueType>
 ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFactor)
-: myHash(8)
+: myMeta(8, Meta{0, 0})
 {
-    this->maxLoadFactor = maximumLoadFactor;
+    this->myNodes = allocateNodes(8);
+    // Open addressing needs some empty buckets to stop probing at
+    this->maxLoadFactor = (maximumLoadFactor > 0 && maximumLoadFactor < 0.9) ? maximumLoadFactor : 0.9;
     this->nNodes = 0;
 }
 
 template<typename KeyType, typename ValueType>
 ExpandableHashMap<KeyType, ValueType>::~ExpandableHashMap()
 {
-    // Our list will not be using dynamically-allocated Nodes,
-    // so all we need to delete are our lists
-    for (int i = 0; i < myHash.size(); i++)
-    {
-        delete myHash[i];
-    }
+    destroyNodes();
+    ::operator delete(myNodes);
 }
 
 template<typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::reset()
 {
-    int nBuckets = myHash.size();
-    
-    for (int i = 0; i < nBuckets; i++)
-    {
-        delete myHash[i];
-        myHash[i] = nullptr;
-    }
-    myHash.resize(8);
-    
-    
+    destroyNodes();
+    ::operator delete(myNodes);
+
+    myMeta.assign(8, Meta{0, 0});
+    myNodes = allocateNodes(8);
+    nNodes = 0;
 }
 
 template<typename KeyType, typename ValueType>
 int ExpandableHashMap<KeyType, ValueType>::size() const
 {
-    return myHash.size();
+    return nNodes;
 }
 
 template<typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
 {
-    
-    // Calculate bucket number
     unsigned int hasher(const KeyType& k);
-    unsigned int index = hasher(key) % myHash.size();
-    
-    // Check to see if bucket is initialized
-    // (i.e. Make sure we are not accessing a nullptr)
-    
-    if (myHash[index] == nullptr)
-        myHash[index] = new std::list<Node>;
-    
-    // If key in bucket, replace ValueType
-    
-    for (auto it = myHash[index]->begin(); it != myHash[index]->end(); it++)
-    {
-        if (it->key == key)
-        {
-            it->val = value;
-            nNodes++;
-            return;
-        }
-    }
-    
-    // If key not already in bucket, insert into bucket.
-    // If adding this Node will go over our MaxLoadFactor, expand.
-    if (maxLoadFactor < (nNodes+1) / myHash.size())
+    unsigned int h = hasher(key);
+
+    // If key already in map, replace ValueType
+    int index = findIndex(key, h);
+    if (index >= 0)
     {
-        expand();
-        unsigned int hasher(const KeyType& k);
-        index = hasher(key) % myHash.size();
+        myNodes[index].val = value;
+        return;
     }
-    
-    nNodes++;
-    if (myHash[index] == nullptr)
-        myHash[index] = new std::list<Node>;
-    
-    myHash[index]->push_back(Node(key, value));
-    
+
+    insertNew(h, key, value);
+}
+
+template<typename KeyType, typename ValueType>
+template<typename... Args>
+ValueType* ExpandableHashMap<KeyType, ValueType>::emplace(const KeyType& key, Args&&... args)
+{
+    unsigned int hasher(const KeyType& k);
+    unsigned int h = hasher(key);
+
+    int index = findIndex(key, h);
+    if (index >= 0)
+        return &myNodes[index].val;
+
+    return &insertNew(h, key, std::forward<Args>(args)...)->val;
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::reserve(int n)
+{
+    std::size_t nBuckets = myMeta.size();
+    while (n > maxLoadFactor * nBuckets)
+        nBuckets *= 2;
+
+    if (nBuckets != myMeta.size())
+        rehash(nBuckets);
 }
 
 template<typename KeyType, typename ValueType>
 const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
 {
     unsigned int hasher(const KeyType& k);
-    unsigned int index = hasher(key) % myHash.size();
-    
-    if (myHash[index] == nullptr) return nullptr;
-    
-    //typename std::list<ValueType>::iterator it = myHash[index]->begin();
-    for (auto p = myHash[index]->begin(); p != myHash[index]->end(); p++)
+    int index = findIndex(key, hasher(key));
+
+    return index >= 0 ? &myNodes[index].val : nullptr;
+}
+
+template<typename KeyType, typename ValueType>
+typename ExpandableHashMap<KeyType, ValueType>::Node* ExpandableHashMap<KeyType, ValueType>::allocateNodes(std::size_t nBuckets)
+{
+    return static_cast<Node*>(::operator new(nBuckets * sizeof(Node)));
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::destroyNodes()
+{
+    for (std::size_t i = 0; i < myMeta.size(); i++)
     {
-        if (p->key == key)
-        {
-            return &(p->val);
-        }
+        if (myMeta[i].dist != 0)
+            myNodes[i].~Node();
     }
-    
-    return nullptr;
 }
 
 template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::expand()
+int ExpandableHashMap<KeyType, ValueType>::findIndex(const KeyType& key, unsigned int h) const
 {
-    int nBuckets = myHash.size();
-    
-    std::vector<std::list<Node>*> newHash(2*nBuckets);
-    
-    for (int i = 0; i < nBuckets; i++)
+    std::size_t mask = myMeta.size() - 1;
+    std::size_t i = h & mask;
+
+    // Once we reach a bucket whose Node is closer to home than key would
+    // be here, key can't be any further along
+    for (unsigned int dist = 1; myMeta[i].dist >= dist; dist++)
+    {
+        if (myMeta[i].hash == h && myNodes[i].key == key)
+            return static_cast<int>(i);
+        i = (i + 1) & mask;
+    }
+
+    return -1;
+}
+
+template<typename KeyType, typename ValueType>
+template<typename... Args>
+typename ExpandableHashMap<KeyType, ValueType>::Node* ExpandableHashMap<KeyType, ValueType>::insertNew(unsigned int h, Args&&... nodeArgs)
+{
+    // If adding this Node will go over our MaxLoadFactor, expand.
+    if (nNodes + 1 > maxLoadFactor * myMeta.size())
+        expand();
+
+    std::size_t mask = myMeta.size() - 1;
+    std::size_t i = h & mask;
+    unsigned int dist = 1;
+
+    // Walk past Nodes that are at least as far from home as we are
+    while (myMeta[i].dist >= dist)
     {
-        if (myHash[i] == nullptr) continue;
-        
-        for (auto p : *myHash[i])
+        i = (i + 1) & mask;
+        dist++;
+    }
+
+    // If bucket i is taken, its Node and the ones after it are closer to
+    // home than we are, so slide that whole run one bucket to the right
+    if (myMeta[i].dist != 0)
+    {
+        std::size_t j = i;
+        while (myMeta[j].dist != 0)
+            j = (j + 1) & mask;
+
+        while (j != i)
         {
-            unsigned int hasher(const KeyType& k);
-            int index = hasher(p.key) % (2*nBuckets);
-            
-            if (newHash[index] == nullptr)
-                newHash[index] = new std::list<Node>;
-            
-            newHash[index]->push_back(Node(p.key, p.val));
-            
+            std::size_t prev = (j - 1) & mask;
+            new (&myNodes[j]) Node(std::move(myNodes[prev]));
+            myNodes[prev].~Node();
+            myMeta[j].hash = myMeta[prev].hash;
+            myMeta[j].dist = myMeta[prev].dist + 1;
+            j = prev;
         }
     }
+
+    new (&myNodes[i]) Node(std::forward<Args>(nodeArgs)...);
+    myMeta[i].hash = h;
+    myMeta[i].dist = dist;
+    nNodes++;
+
+    return &myNodes[i];
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::rehash(std::size_t nBuckets)
+{
+    std::vector<Meta> oldMeta(nBuckets, Meta{0, 0});
+    oldMeta.swap(myMeta);
+    Node* oldNodes = myNodes;
+    myNodes = allocateNodes(nBuckets);
+    nNodes = 0;
+
+    // Move every Node over rather than copying it
+    for (std::size_t i = 0; i < oldMeta.size(); i++)
+    {
+        if (oldMeta[i].dist == 0)
+            continue;
+
+        insertNew(oldMeta[i].hash, std::move(oldNodes[i]));
+        oldNodes[i].~Node();
+    }
+
     // Delete old hash table (free the memory)
-    reset();
+    ::operator delete(oldNodes);
+}
 
-    myHash = newHash;
-    
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::expand()
+{
+    rehash(2 * myMeta.size());
 }
 
 #endif /* ExpandableHashMap_h */
@@ -0,0 +1,78 @@
+//
+//  FixedCoord.h
+//  Goober-Eats
+//
+
+#ifndef FixedCoord_h
+#define FixedCoord_h
+
+#include "provided.h"
+#include <cstdint>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+// A coordinate stored as whole multiples of 1e-7 degrees, the precision
+// map files are written in. Eight bytes, no strings, so it makes a cheap
+// hash key. Two GeoCoords whose text differs only in trailing zeros
+// (34.05 and 34.0500000) give the same FixedCoord.
+
+struct FixedCoord
+{
+    static constexpr double SCALE = 1e7;
+
+    int32_t lat;
+    int32_t lon;
+
+    FixedCoord() : lat(0), lon(0) {}
+    FixedCoord(int32_t lat, int32_t lon) : lat(lat), lon(lon) {}
+
+    explicit FixedCoord(const GeoCoord& gc)
+     : lat(static_cast<int32_t>(std::llround(gc.latitude * SCALE))),
+       lon(static_cast<int32_t>(std::llround(gc.longitude * SCALE)))
+    {}
+
+    double latitude() const { return lat / SCALE; }
+    double longitude() const { return lon / SCALE; }
+
+    // Back to a GeoCoord, with the text written to 7 decimal places
+    GeoCoord toGeoCoord() const
+    {
+        return GeoCoord(fixedText(lat), fixedText(lon));
+    }
+
+private:
+    static std::string fixedText(int32_t v)
+    {
+        char buf[16];
+        int64_t a = v < 0 ? -int64_t(v) : int64_t(v);
+        snprintf(buf, sizeof(buf), "%s%lld.%07lld", v < 0 ? "-" : "",
+                 static_cast<long long>(a / 10000000), static_cast<long long>(a % 10000000));
+        return buf;
+    }
+};
+
+inline bool operator==(const FixedCoord& lhs, const FixedCoord& rhs)
+{
+    return lhs.lat == rhs.lat && lhs.lon == rhs.lon;
+}
+
+inline bool operator!=(const FixedCoord& lhs, const FixedCoord& rhs)
+{
+    return !(lhs == rhs);
+}
+
+// 64-bit finalizer from MurmurHash3 over both halves. Node lookup tables in
+// map snapshots are built with this, so it must not change between builds.
+inline unsigned int hasher(const FixedCoord& c)
+{
+    uint64_t k = (uint64_t(uint32_t(c.lat)) << 32) | uint32_t(c.lon);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return static_cast<unsigned int>(k);
+}
+
+#endif /* FixedCoord_h */
@@ -0,0 +1,202 @@
+#include "Landmarks.h"
+#include "SearchContext.h"
+#include <fstream>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+//******************** Landmark file layout ***********************************
+
+// A landmark file is a fixed header followed by the payload: the landmark
+// nodes, then every node's distances to them. As in map snapshots, each
+// array starts on an 8-byte boundary and the payload is checksummed.
+
+namespace
+{
+    const char LANDMARKS_MAGIC[8] = { 'G', 'O', 'O', 'B', 'A', 'L', 'T', '\0' };
+    const uint32_t LANDMARKS_VERSION = 1;
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct LandmarksHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t nNodes;
+        uint64_t count;
+        uint64_t fingerprint;       // of the graph the landmarks belong to
+        uint64_t payloadSize;
+        uint64_t checksum;
+    };
+
+    uint64_t align8(uint64_t n)
+    {
+        return (n + 7) & ~uint64_t(7);
+    }
+}
+
+//******************** Landmarks functions ************************************
+
+const int Landmarks::MAX_LANDMARKS;
+constexpr double Landmarks::UNREACHABLE;
+
+Landmarks::Landmarks()
+: m_fingerprint(0), m_count(0)
+{
+}
+
+void Landmarks::build(const StreetGraph& g, int count)
+{
+    int nNodes = g.nodeCount();
+    count = max(min(count, min(MAX_LANDMARKS, nNodes)), 0);
+
+    m_fingerprint = g.fingerprint();
+    m_count = count;
+    m_landmarks.clear();
+    m_dist.assign(static_cast<size_t>(nNodes) * count, UNREACHABLE);
+
+    // Street distance from each node to the nearest landmark so far
+    vector<double> nearest(nNodes, numeric_limits<double>::infinity());
+    SearchContext ctx;
+
+    // Full Dijkstra from n; returns the farthest node it reached
+    auto searchFrom = [&](NodeId n)
+    {
+        ctx.begin(nNodes);
+        ctx.relax(n, 0, StreetGraph::NO_NODE, SearchContext::NO_EDGE, 0);
+        NodeId farthest = n;
+        while (!ctx.empty())
+        {
+            NodeId current = ctx.popMin();
+            farthest = current;
+            double d = ctx.g(current);
+            for (StreetGraph::EdgeId e = g.firstEdge(current); e != g.endEdge(current); e++)
+            {
+                double next = d + g.edgeLength(e);
+                ctx.relax(g.edgeTarget(e), next, current, e, next);
+            }
+        }
+        return farthest;
+    };
+
+    // The first landmark is the node farthest from an arbitrary start
+    NodeId next = count > 0 ? searchFrom(0) : 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        m_landmarks.push_back(next);
+        searchFrom(next);
+
+        for (NodeId n = 0; n < static_cast<NodeId>(nNodes); n++)
+        {
+            if (ctx.closed(n))
+            {
+                m_dist[static_cast<size_t>(n) * count + i] = ctx.g(n);
+                nearest[n] = min(nearest[n], ctx.g(n));
+            }
+        }
+
+        // Next, the node farthest from every landmark so far. Nodes no
+        // landmark can reach are left alone: they are usually a stray
+        // piece of road, not worth a landmark of their own.
+        double farthest = -1;
+        for (NodeId n = 0; n < static_cast<NodeId>(nNodes); n++)
+        {
+            if (nearest[n] != numeric_limits<double>::infinity() && nearest[n] > farthest)
+            {
+                farthest = nearest[n];
+                next = n;
+            }
+        }
+    }
+}
+
+bool Landmarks::save(const string& file) const
+{
+    uint64_t nNodes = m_count > 0 ? m_dist.size() / m_count : 0;
+    uint64_t landmarkBytes = align8(sizeof(NodeId) * m_count);
+    uint64_t distBytes = sizeof(double) * m_dist.size();
+
+    vector<uint64_t> buffer((landmarkBytes + distBytes) / 8, 0);
+    char* payload = reinterpret_cast<char*>(buffer.data());
+    memcpy(payload, m_landmarks.data(), sizeof(NodeId) * m_count);
+    memcpy(payload + landmarkBytes, m_dist.data(), distBytes);
+
+    LandmarksHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LANDMARKS_MAGIC, sizeof(header.magic));
+    header.version = LANDMARKS_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.nNodes = nNodes;
+    header.count = m_count;
+    header.fingerprint = m_fingerprint;
+    header.payloadSize = 8 * buffer.size();
+    header.checksum = StreetGraph::checksum(payload, header.payloadSize);
+
+    ofstream outfile(file, ios::binary | ios::trunc);
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(payload, header.payloadSize);
+    if (!outfile)
+    {
+        cerr << "Cannot write " << file << "!" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Landmarks::load(const string& file, const StreetGraph& g)
+{
+    ifstream infile(file, ios::binary);
+    if (!infile)
+    {
+        cerr << "Cannot open " << file << "!" << endl;
+        return false;
+    }
+
+    LandmarksHeader header;
+    vector<uint64_t> buffer;
+    uint64_t landmarkBytes = 0;
+    const char* problem = nullptr;
+
+    if (!infile.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, LANDMARKS_MAGIC, sizeof(header.magic)) != 0)
+        problem = "not a landmark file";
+    else if (header.version != LANDMARKS_VERSION)
+        problem = "unsupported landmark file version";
+    else if (header.byteOrder != BYTE_ORDER_MARK)
+        problem = "landmarks were written on a machine with a different byte order";
+    else if (header.nNodes != static_cast<uint64_t>(g.nodeCount()) || header.fingerprint != g.fingerprint())
+        problem = "landmarks were built for a different map";
+    else if (header.count > static_cast<uint64_t>(MAX_LANDMARKS))
+        problem = "too many landmarks";
+    else
+    {
+        landmarkBytes = align8(sizeof(NodeId) * header.count);
+        if (header.payloadSize != landmarkBytes + sizeof(double) * header.nNodes * header.count)
+            problem = "landmark file has inconsistent sizes";
+        else
+        {
+            buffer.resize(header.payloadSize / 8);
+            if (!infile.read(reinterpret_cast<char*>(buffer.data()), header.payloadSize))
+                problem = "landmark file is truncated";
+            else if (StreetGraph::checksum(reinterpret_cast<const char*>(buffer.data()), header.payloadSize) != header.checksum)
+                problem = "landmark file checksum mismatch";
+        }
+    }
+
+    if (problem != nullptr)
+    {
+        cerr << file << ": " << problem << "!" << endl;
+        return false;
+    }
+
+    const char* p = reinterpret_cast<const char*>(buffer.data());
+    m_count = static_cast<int>(header.count);
+    m_landmarks.resize(m_count);
+    memcpy(m_landmarks.data(), p, sizeof(NodeId) * m_count);
+    m_dist.resize(header.nNodes * header.count);
+    memcpy(m_dist.data(), p + landmarkBytes, sizeof(double) * m_dist.size());
+    m_fingerprint = header.fingerprint;
+    return true;
+}
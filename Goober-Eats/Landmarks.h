@@ -0,0 +1,77 @@
+//
+//  Landmarks.h
+//  Goober-Eats
+//
+
+#ifndef Landmarks_h
+#define Landmarks_h
+
+#include "StreetGraph.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Street distances from a few landmark nodes to every node in a
+// StreetGraph, for the ALT (A*, landmarks, triangle inequality) router
+// heuristic.
+//
+// Streets go both ways with the same length, so by the triangle inequality
+// |d(L, t) - d(L, v)| <= d(v, t) for any landmark L. Unlike the straight
+// line distance, this bound knows about rivers, freeways and dead ends
+// between v and t, so A* guided by it expands far fewer nodes.
+//
+// Landmarks are picked far apart and near the edge of the map, where they
+// give the tightest bounds: each new one is the node farthest by street
+// from all the ones picked so far. Like a ContractionHierarchy, a set of
+// landmarks records the fingerprint of its graph when saved, and load
+// refuses to pair it with any other.
+
+class Landmarks
+{
+public:
+    typedef StreetGraph::NodeId NodeId;
+
+    static const int MAX_LANDMARKS = 64;
+
+    Landmarks();
+
+    // Pick count landmarks (at most MAX_LANDMARKS) and find the distance
+    // from each one to every node
+    void build(const StreetGraph& g, int count);
+
+    bool save(const std::string& file) const;
+    bool load(const std::string& file, const StreetGraph& g);
+
+    int count() const { return m_count; }
+    NodeId landmark(int i) const { return m_landmarks[i]; }
+
+    // A lower bound on the street distance between from and to. Landmarks
+    // in another part of a disconnected map say nothing and are skipped.
+    double lowerBound(NodeId from, NodeId to) const
+    {
+        const double* a = &m_dist[static_cast<size_t>(from) * m_count];
+        const double* b = &m_dist[static_cast<size_t>(to) * m_count];
+        double bound = 0;
+        for (int i = 0; i < m_count; i++)
+        {
+            if (a[i] != UNREACHABLE && b[i] != UNREACHABLE)
+                bound = std::max(bound, std::fabs(a[i] - b[i]));
+        }
+        return bound;
+    }
+
+    Landmarks(const Landmarks&) = delete;
+    Landmarks& operator=(const Landmarks&) = delete;
+
+private:
+    static constexpr double UNREACHABLE = -1;
+
+    uint64_t m_fingerprint;         // of the graph these were built for
+    int m_count;
+    std::vector<NodeId> m_landmarks;
+    std::vector<double> m_dist;     // node n's distances are [n*count, (n+1)*count)
+};
+
+#endif /* Landmarks_h */
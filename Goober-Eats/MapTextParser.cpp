@@ -0,0 +1,288 @@
+#include "MapTextParser.h"
+#include <vector>
+#include <thread>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+
+// POSIX facilities for memory-mapping the map file
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    // Don't bother starting a thread for less than this much text
+    const size_t MIN_CHUNK_BYTES = 1 << 20;
+
+    struct ParsedStreet
+    {
+        string name;
+        size_t nSegments;
+    };
+
+    struct ParsedSegment
+    {
+        GeoCoord start;
+        GeoCoord end;
+    };
+
+    // Everything parsed out of one chunk, in file order
+    struct Chunk
+    {
+        const char* begin;
+        const char* end;
+        vector<ParsedStreet> streets;
+        vector<ParsedSegment> segments;
+    };
+
+    bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    const char* skipLine(const char* p, const char* end)
+    {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        return nl != nullptr ? nl + 1 : end;
+    }
+
+    // Reads an int the way operator>> would, leaving p after it.
+    // Returns false if there isn't one.
+    bool parseCount(const char*& p, const char* end, size_t& count)
+    {
+        while (p < end && isSpace(*p))
+            p++;
+        if (p < end && *p == '+')
+            p++;
+        if (p == end || *p < '0' || *p > '9')
+            return false;
+        count = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+            count = count * 10 + (*p++ - '0');
+        return true;
+    }
+
+    // Converts decimal text like -118.4794734 to the double std::stod
+    // would give. A mantissa below 2^53 divided by an exact power of ten is
+    // correctly rounded, so for such text this matches stod exactly;
+    // anything else (exponents, very long text) is passed to stod itself.
+    double parseDecimal(const char* b, const char* e)
+    {
+        static const double POW10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        const char* p = b;
+        bool negative = (p < e && *p == '-');
+        if (p < e && (*p == '-' || *p == '+'))
+            p++;
+
+        uint64_t mantissa = 0;
+        int nDigits = 0;
+        int nFraction = 0;
+        bool seenPoint = false;
+        for ( ; p < e; p++)
+        {
+            if (*p >= '0' && *p <= '9')
+            {
+                if (++nDigits > 15)
+                    break;
+                mantissa = mantissa * 10 + (*p - '0');
+                if (seenPoint)
+                    nFraction++;
+            }
+            else if (*p == '.' && !seenPoint)
+                seenPoint = true;
+            else
+                break;
+        }
+
+        if (p != e || nDigits == 0)
+            return stod(string(b, e));
+
+        double value = static_cast<double>(mantissa) / POW10[nFraction];
+        return negative ? -value : value;
+    }
+
+    // Reads the next whitespace-delimited token the way operator>> would
+    bool nextToken(const char*& p, const char* end, const char*& tokBegin, const char*& tokEnd)
+    {
+        while (p < end && isSpace(*p))
+            p++;
+        if (p == end)
+            return false;
+        tokBegin = p;
+        while (p < end && !isSpace(*p))
+            p++;
+        tokEnd = p;
+        return true;
+    }
+
+    bool parseCoord(const char*& p, const char* end, GeoCoord& gc)
+    {
+        const char *latB, *latE, *lonB, *lonE;
+        if (!nextToken(p, end, latB, latE) || !nextToken(p, end, lonB, lonE))
+            return false;
+
+        // Fill the fields in directly rather than going through the
+        // GeoCoord(string, string) constructor and its two stod calls
+        gc.latitudeText.assign(latB, latE);
+        gc.longitudeText.assign(lonB, lonE);
+        gc.latitude = parseDecimal(latB, latE);
+        gc.longitude = parseDecimal(lonB, lonE);
+        return true;
+    }
+
+    // Parses the street records in [chunk.begin, chunk.end)
+    void parseChunk(Chunk& chunk)
+    {
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+
+        while (p < end)
+        {
+            const char* nameEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (nameEnd == nullptr)
+                nameEnd = end;
+            ParsedStreet street;
+            street.name.assign(p, nameEnd);
+            p = (nameEnd < end) ? nameEnd + 1 : end;
+
+            size_t nSegments;
+            if (!parseCount(p, end, nSegments))
+                break;
+            p = skipLine(p, end);
+
+            street.nSegments = 0;
+            for (size_t i = 0; i < nSegments; i++)
+            {
+                ParsedSegment seg;
+                if (!parseCoord(p, end, seg.start) || !parseCoord(p, end, seg.end))
+                    break;
+                p = skipLine(p, end);
+                chunk.segments.push_back(seg);
+                street.nSegments++;
+            }
+            chunk.streets.push_back(street);
+        }
+    }
+
+    // Finds where each street record starts, by walking name lines and
+    // segment counts. Only looks for newlines, so it runs at memchr speed.
+    vector<const char*> findRecordStarts(const char* p, const char* end)
+    {
+        vector<const char*> starts;
+        while (p < end)
+        {
+            const char* record = p;
+            p = skipLine(p, end);   // street name
+
+            size_t nSegments;
+            const char* countEnd = p;
+            if (!parseCount(countEnd, end, nSegments))
+                break;
+            starts.push_back(record);
+            p = skipLine(countEnd, end);
+
+            for (size_t i = 0; i < nSegments && p < end; i++)
+                p = skipLine(p, end);
+        }
+        starts.push_back(end);
+        return starts;
+    }
+}
+
+bool parseMapText(const string& mapFile, StreetGraphBuilder& builder, MapLoadStats& stats)
+{
+    int fd = open(mapFile.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        cerr << "Cannot open " << mapFile << "!";
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = nullptr;
+    if (size > 0)
+    {
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(fd);
+            cerr << "Cannot map " << mapFile << "!";
+            return false;
+        }
+    }
+    close(fd);
+
+    const char* text = static_cast<const char*>(mapping);
+    vector<const char*> starts = findRecordStarts(text, text + size);
+    size_t nRecords = starts.size() - 1;
+
+    // Carve the records into roughly equal-sized runs, one per thread
+    size_t nThreads = thread::hardware_concurrency();
+    if (nThreads == 0)
+        nThreads = 1;
+    if (nThreads > size / MIN_CHUNK_BYTES + 1)
+        nThreads = size / MIN_CHUNK_BYTES + 1;
+
+    vector<Chunk> chunks;
+    size_t record = 0;
+    for (size_t t = 0; t < nThreads && record < nRecords; t++)
+    {
+        const char* target = text + size * (t + 1) / nThreads;
+        size_t last = record + 1;
+        while (last < nRecords && starts[last] < target)
+            last++;
+        Chunk chunk;
+        chunk.begin = starts[record];
+        chunk.end = starts[last];
+        chunks.push_back(chunk);
+        record = last;
+    }
+
+    vector<thread> workers;
+    for (size_t i = 1; i < chunks.size(); i++)
+        workers.push_back(thread(parseChunk, ref(chunks[i])));
+    if (!chunks.empty())
+        parseChunk(chunks[0]);
+    for (thread& t : workers)
+        t.join();
+
+    size_t nSegments = 0;
+    for (const Chunk& chunk : chunks)
+        nSegments += chunk.segments.size();
+    builder.reserve(nSegments);
+
+    // Merge in file order so node and street IDs come out as they would
+    // from a single sequential pass
+    for (const Chunk& chunk : chunks)
+    {
+        size_t seg = 0;
+        for (const ParsedStreet& street : chunk.streets)
+        {
+            uint32_t id = builder.addStreet(street.name);
+            for (size_t i = 0; i < street.nSegments; i++, seg++)
+            {
+                const ParsedSegment& s = chunk.segments[seg];
+                builder.addSegment(builder.addNode(s.start), builder.addNode(s.end), id);
+            }
+        }
+    }
+
+    if (mapping != nullptr)
+        munmap(mapping, size);
+
+    stats.bytes = size;
+    stats.threads = static_cast<int>(chunks.size());
+    return true;
+}
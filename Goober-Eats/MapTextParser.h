@@ -0,0 +1,25 @@
+//
+//  MapTextParser.h
+//  Goober-Eats
+//
+
+#ifndef MapTextParser_h
+#define MapTextParser_h
+
+#include "StreetGraph.h"
+#include <string>
+
+// Reads a text map file (mapdata.txt format) into a StreetGraphBuilder.
+//
+// The file is mapped into memory and split into chunks at street-record
+// boundaries. Chunks are tokenized and their numbers converted on separate
+// threads without building intermediate strings, then fed to the builder
+// in file order, so the resulting graph is identical to reading the file
+// one record at a time.
+//
+// Each segment must be on a line of its own, as the map format specifies.
+// Returns false if the file can't be opened. Fills in the byte and thread
+// counts in stats.
+bool parseMapText(const std::string& mapFile, StreetGraphBuilder& builder, MapLoadStats& stats);
+
+#endif /* MapTextParser_h */
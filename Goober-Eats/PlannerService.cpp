@@ -0,0 +1,522 @@
+#include "PlannerService.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+// POSIX facilities for file descriptors and Unix sockets
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+
+using namespace std;
+
+namespace
+{
+    // How many requests may wait between one stage and the next before the
+    // stage feeding them has to wait too
+    const size_t QUEUE_CAPACITY = 64;
+
+    // How long to wait before accepting again after the system ran short
+    // of something a connection needs
+    const int ACCEPT_RETRY_MS = 100;
+
+    // Hands items from one thread to another, in order. pop() returns false
+    // once the queue is closed and empty.
+    template <typename T>
+    class PipeQueue
+    {
+    public:
+        PipeQueue() : m_closed(false) {}
+
+        void push(T item)
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_notFull.wait(lock, [this]() { return m_items.size() < QUEUE_CAPACITY; });
+            m_items.push_back(std::move(item));
+            m_notEmpty.notify_one();
+        }
+
+        bool pop(T& item)
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+            if (m_items.empty())
+                return false;
+            item = std::move(m_items.front());
+            m_items.pop_front();
+            m_notFull.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_closed = true;
+            m_notEmpty.notify_all();
+        }
+
+    private:
+        deque<T> m_items;
+        bool m_closed;
+        mutex m_mutex;
+        condition_variable m_notEmpty;
+        condition_variable m_notFull;
+    };
+
+    // Buffered line reading straight from a file descriptor
+    class LineReader
+    {
+    public:
+        explicit LineReader(int fd) : m_fd(fd), m_pos(0) {}
+
+        // false at end of input
+        bool readLine(string& line)
+        {
+            for (;;)
+            {
+                size_t newline = m_buffer.find('\n', m_pos);
+                if (newline != string::npos)
+                {
+                    line.assign(m_buffer, m_pos, newline - m_pos);
+                    m_pos = newline + 1;
+                    if (!line.empty() && line.back() == '\r')
+                        line.pop_back();
+                    return true;
+                }
+
+                m_buffer.erase(0, m_pos);
+                m_pos = 0;
+                char chunk[4096];
+                ssize_t got = read(m_fd, chunk, sizeof(chunk));
+                if (got <= 0)
+                {
+                    // A last line with no newline still counts
+                    if (m_buffer.empty())
+                        return false;
+                    line.swap(m_buffer);
+                    m_buffer.clear();
+                    return true;
+                }
+                m_buffer.append(chunk, static_cast<size_t>(got));
+            }
+        }
+
+    private:
+        int m_fd;
+        string m_buffer;
+        size_t m_pos;       // start of the first line not yet read
+    };
+
+    bool writeAll(int fd, const string& text)
+    {
+        const char* p = text.data();
+        size_t left = text.size();
+        while (left > 0)
+        {
+            ssize_t wrote = write(fd, p, left);
+            if (wrote <= 0)
+                return false;
+            p += wrote;
+            left -= static_cast<size_t>(wrote);
+        }
+        return true;
+    }
+
+    // A number written out in full, rather than whatever prefix of one
+    // std::stod would settle for
+    bool isNumber(const string& text)
+    {
+        if (text.empty())
+            return false;
+        char* end = nullptr;
+        strtod(text.c_str(), &end);
+        return *end == '\0';
+    }
+
+    bool parseCoord(istream& in, GeoCoord& gc)
+    {
+        string lat, lon;
+        if (!(in >> lat >> lon) || !isNumber(lat) || !isNumber(lon))
+            return false;
+        gc = GeoCoord(lat, lon);
+        return true;
+    }
+
+    const char* statusName(DeliveryResult result)
+    {
+        switch (result)
+        {
+            case DELIVERY_SUCCESS:
+                return "OK";
+            case NO_ROUTE:
+                return "NO_ROUTE";
+            case BAD_COORD:
+                return "BAD_COORD";
+        }
+        return "NO_ROUTE";
+    }
+}
+
+class PlannerServiceImpl
+{
+public:
+    PlannerServiceImpl(const StreetMap* sm, bool snapToStreets);
+    bool serve(int inFd, int outFd);
+    bool serveUnixSocket(const string& socketPath);
+private:
+    typedef chrono::steady_clock::time_point TimePoint;
+
+    // A request as parsed, then as planned
+    struct Job
+    {
+        Job() : badRequest(false), result(NO_ROUTE), distance(0) {}
+
+        string id;
+        bool badRequest;
+        GeoCoord depot;
+        vector<DeliveryRequest> deliveries;
+        TimePoint received;
+
+        DeliveryResult result;
+        vector<DeliveryCommand> commands;
+        double distance;
+    };
+
+    DeliveryPlanner m_planner;
+
+    // Read frames until QUIT, SHUTDOWN or end of input; false on SHUTDOWN
+    bool readJobs(LineReader& reader, PipeQueue<Job>& toPlan) const;
+
+    void planJobs(PipeQueue<Job>& toPlan, PipeQueue<Job>& toWrite) const;
+    void writeAnswers(PipeQueue<Job>& toWrite, int outFd) const;
+};
+
+PlannerServiceImpl::PlannerServiceImpl(const StreetMap* sm, bool snapToStreets)
+: m_planner(sm, snapToStreets)
+{
+}
+
+bool PlannerServiceImpl::serve(int inFd, int outFd)
+{
+    PipeQueue<Job> toPlan;
+    PipeQueue<Job> toWrite;
+
+    thread planner([&]() {
+        planJobs(toPlan, toWrite);
+        toWrite.close();
+    });
+    thread writer([&]() { writeAnswers(toWrite, outFd); });
+
+    LineReader reader(inFd);
+    bool keepServing = readJobs(reader, toPlan);
+    toPlan.close();
+
+    planner.join();
+    writer.join();
+    return keepServing;
+}
+
+bool PlannerServiceImpl::readJobs(LineReader& reader, PipeQueue<Job>& toPlan) const
+{
+    string line;
+    while (reader.readLine(line))
+    {
+        istringstream header(line);
+        string word;
+        if (!(header >> word))
+            continue;
+        if (word == "QUIT")
+            return true;
+        if (word == "SHUTDOWN")
+            return false;
+
+        Job job;
+        job.received = chrono::steady_clock::now();
+        int n = 0;
+        if (word != "PLAN" || !(header >> job.id >> n) || n < 0)
+        {
+            // Without a count there's no telling where the frame ends, so
+            // answer for this line alone and carry on with the next
+            job.badRequest = true;
+            toPlan.push(std::move(job));
+            continue;
+        }
+
+        // A frame cut off by the end of input still gets its answer
+        if (!reader.readLine(line))
+        {
+            job.badRequest = true;
+            toPlan.push(std::move(job));
+            return true;
+        }
+        istringstream depotLine(line);
+        if (!parseCoord(depotLine, job.depot))
+            job.badRequest = true;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (!reader.readLine(line))
+            {
+                job.badRequest = true;
+                toPlan.push(std::move(job));
+                return true;
+            }
+
+            // Lines are as in deliveries.txt: latitude longitude:item
+            size_t colon = line.find(':');
+            GeoCoord location;
+            istringstream coords(line.substr(0, colon));
+            if (colon == string::npos || colon + 1 == line.size() || !parseCoord(coords, location))
+                job.badRequest = true;
+            else
+                job.deliveries.push_back(DeliveryRequest(line.substr(colon + 1), location));
+        }
+
+        toPlan.push(std::move(job));
+    }
+    return true;
+}
+
+void PlannerServiceImpl::planJobs(PipeQueue<Job>& toPlan, PipeQueue<Job>& toWrite) const
+{
+    Job job;
+    while (toPlan.pop(job))
+    {
+        if (!job.badRequest)
+            job.result = m_planner.generateDeliveryPlan(job.depot, job.deliveries, job.commands, job.distance);
+        toWrite.push(std::move(job));
+    }
+}
+
+void PlannerServiceImpl::writeAnswers(PipeQueue<Job>& toWrite, int outFd) const
+{
+    bool connected = true;
+    Job job;
+    while (toWrite.pop(job))
+    {
+        // Once the other end has gone, drain the queue without writing
+        if (!connected)
+            continue;
+
+        ostringstream answer;
+        answer.setf(ios::fixed);
+        answer.precision(6);
+        answer << "RESULT " << (job.id.empty() ? "-" : job.id) << ' '
+               << (job.badRequest ? "BAD_REQUEST" : statusName(job.result)) << ' '
+               << job.distance << ' ';
+        size_t nCommands = job.result == DELIVERY_SUCCESS ? job.commands.size() : 0;
+        string commands;
+        for (size_t i = 0; i < nCommands; i++)
+            commands += job.commands[i].description() + '\n';
+
+        long long micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - job.received).count();
+        answer << micros << ' ' << nCommands << '\n' << commands;
+        connected = writeAll(outFd, answer.str());
+    }
+}
+
+bool PlannerServiceImpl::serveUnixSocket(const string& socketPath)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return false;
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return false;
+
+    // Clear away a socket left behind by an earlier run, but nothing else
+    struct stat existing;
+    if (lstat(socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+        unlink(socketPath.c_str());
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, 16) != 0)
+    {
+        close(listener);
+        return false;
+    }
+
+    // A client that hangs up early should cost us its answers, not the
+    // whole process
+    signal(SIGPIPE, SIG_IGN);
+
+    bool listening = true;
+    bool keepServing = true;
+    while (keepServing)
+    {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0)
+        {
+            // Running out of descriptors or memory may pass, so wait a
+            // little rather than spin; any other failure won't
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                this_thread::sleep_for(chrono::milliseconds(ACCEPT_RETRY_MS));
+                continue;
+            }
+            listening = false;
+            break;
+        }
+        keepServing = serve(connection, connection);
+        close(connection);
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    return listening;
+}
+
+//******************** PlannerService functions *******************************
+
+// These functions simply delegate to PlannerServiceImpl's functions.
+
+PlannerService::PlannerService(const StreetMap* sm, bool snapToStreets)
+{
+    m_impl = new PlannerServiceImpl(sm, snapToStreets);
+}
+
+PlannerService::~PlannerService()
+{
+    delete m_impl;
+}
+
+bool PlannerService::serve(int inFd, int outFd)
+{
+    return m_impl->serve(inFd, outFd);
+}
+
+bool PlannerService::serveUnixSocket(const string& socketPath)
+{
+    return m_impl->serveUnixSocket(socketPath);
+}
+
+//******************** PlannerClient functions ********************************
+
+PlannerClient::PlannerClient()
+: m_fd(-1), m_nextId(1)
+{
+}
+
+PlannerClient::~PlannerClient()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+bool PlannerClient::connect(const string& socketPath)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return false;
+    strcpy(address.sun_path, socketPath.c_str());
+
+    if (m_fd >= 0)
+        close(m_fd);
+    m_buffer.clear();
+    m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0)
+        return false;
+    if (::connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool PlannerClient::plan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+                         DeliveryResult& result, vector<string>& commands,
+                         double& miles, double& seconds)
+{
+    commands.clear();
+    miles = 0;
+    seconds = 0;
+    result = NO_ROUTE;
+    if (m_fd < 0)
+        return false;
+
+    // The coordinates go back out exactly as they came in
+    string id = to_string(m_nextId++);
+    string request = "PLAN " + id + ' ' + to_string(deliveries.size()) + '\n' +
+                     depot.latitudeText + ' ' + depot.longitudeText + '\n';
+    for (const DeliveryRequest& d : deliveries)
+        request += d.location.latitudeText + ' ' + d.location.longitudeText + ':' + d.item + '\n';
+    if (!writeAll(request))
+        return false;
+
+    string line;
+    if (!readLine(line))
+        return false;
+    istringstream header(line);
+    string word, answerId, status;
+    long long micros = 0;
+    size_t nCommands = 0;
+    if (!(header >> word >> answerId >> status >> miles >> micros >> nCommands) ||
+        word != "RESULT" || answerId != id)
+        return false;
+    for (size_t i = 0; i < nCommands; i++)
+    {
+        if (!readLine(line))
+            return false;
+        commands.push_back(line);
+    }
+    seconds = micros / 1e6;
+
+    if (status == "OK")
+        result = DELIVERY_SUCCESS;
+    else if (status == "BAD_COORD")
+        result = BAD_COORD;
+    else if (status == "NO_ROUTE")
+        result = NO_ROUTE;
+    else
+        return false;
+    return true;
+}
+
+void PlannerClient::shutdownService()
+{
+    if (m_fd < 0)
+        return;
+    writeAll("SHUTDOWN\n");
+    close(m_fd);
+    m_fd = -1;
+}
+
+bool PlannerClient::readLine(string& line)
+{
+    size_t newline;
+    while ((newline = m_buffer.find('\n')) == string::npos)
+    {
+        char chunk[4096];
+        ssize_t got = read(m_fd, chunk, sizeof(chunk));
+        if (got <= 0)
+            return false;
+        m_buffer.append(chunk, static_cast<size_t>(got));
+    }
+    line.assign(m_buffer, 0, newline);
+    m_buffer.erase(0, newline + 1);
+    return true;
+}
+
+bool PlannerClient::writeAll(const string& text)
+{
+    return ::writeAll(m_fd, text);
+}
@@ -0,0 +1,97 @@
+//
+//  PlannerService.h
+//  Goober-Eats
+//
+
+#ifndef PlannerService_h
+#define PlannerService_h
+
+#include "provided.h"
+#include <vector>
+#include <string>
+
+class PlannerServiceImpl;
+
+// A planner that keeps its map loaded and takes delivery jobs as text, so a
+// stream of small jobs pays for loading the map once rather than per job.
+// It talks over a pair of file descriptors (stdin and stdout, say) or over
+// a local Unix socket, one connection at a time.
+//
+// Each request is one frame of lines:
+//
+//     PLAN <id> <n>
+//     <depot latitude> <depot longitude>
+//     <latitude> <longitude>:<item>        (n lines, as in deliveries.txt)
+//
+// and is answered, in the order the requests came in, by
+//
+//     RESULT <id> <status> <miles> <microseconds> <m>
+//     <command>                            (m lines)
+//
+// where status is OK, NO_ROUTE, BAD_COORD or BAD_REQUEST, the commands are
+// DeliveryCommand descriptions, and microseconds is the latency from the
+// request being read to its answer being written. A frame cut short by the
+// end of input is answered BAD_REQUEST. A line QUIT ends the session;
+// SHUTDOWN ends it and, on a socket, stops the service too.
+//
+// Reading and parsing, planning, and writing answers each have a thread of
+// their own, joined by short queues, so one request can be parsed while
+// the one before it is planned and the one before that is written out.
+
+class PlannerService
+{
+public:
+    PlannerService(const StreetMap* sm, bool snapToStreets = false);
+    ~PlannerService();
+
+      // Answer requests from inFd on outFd until QUIT, SHUTDOWN or end of
+      // input; false if it was SHUTDOWN
+    bool serve(int inFd, int outFd);
+
+      // Listen on a Unix socket at socketPath, serving each connection in
+      // turn until one sends SHUTDOWN; false if the socket can't be set up
+      // or stops accepting connections. A socket left at socketPath by an
+      // earlier run is replaced; anything else there is left alone.
+    bool serveUnixSocket(const std::string& socketPath);
+
+      // We prevent a PlannerService object from being copied or assigned.
+    PlannerService(const PlannerService&) = delete;
+    PlannerService& operator=(const PlannerService&) = delete;
+private:
+    PlannerServiceImpl* m_impl;
+};
+
+// A bare-bones client for a PlannerService listening on a Unix socket,
+// sending one job at a time and waiting for its answer.
+
+class PlannerClient
+{
+public:
+    PlannerClient();
+    ~PlannerClient();
+
+    bool connect(const std::string& socketPath);
+
+      // Plan one job. commands gets the DeliveryCommand descriptions and
+      // seconds the latency the service reported. False if the connection
+      // failed or the service didn't understand the request.
+    bool plan(const GeoCoord& depot, const std::vector<DeliveryRequest>& deliveries,
+              DeliveryResult& result, std::vector<std::string>& commands,
+              double& miles, double& seconds);
+
+      // Ask the service to stop, and close the connection
+    void shutdownService();
+
+      // We prevent a PlannerClient object from being copied or assigned.
+    PlannerClient(const PlannerClient&) = delete;
+    PlannerClient& operator=(const PlannerClient&) = delete;
+private:
+    int m_fd;
+    int m_nextId;
+    std::string m_buffer;   // read but not yet taken as a line
+
+    bool readLine(std::string& line);
+    bool writeAll(const std::string& text);
+};
+
+#endif /* PlannerService_h */
@@ -1,46 +1,87 @@
 #include "provided.h"
 #include <list>
-#include <set>
-#include <map>
+#include <vector>
+#include <algorithm>
+#include <limits>
 
+#include "StreetGraph.h"
+#include "SearchContext.h"
+#include "ContractionHierarchy.h"
+#include "Landmarks.h"
+#include "CrowDistance.h"
+#include "ThreadPool.h"
 #include "support.h"
 
 
 using namespace std;
 
+namespace
+{
+    // Search state each thread reuses from query to query, so searches
+    // allocate nothing once warmed up. Single-ended searches use only the
+    // forward context.
+    thread_local SearchContext forwardSearch;
+    thread_local SearchContext backwardSearch;
+}
+
 class PointToPointRouterImpl
 {
 public:
-    PointToPointRouterImpl(const StreetMap* sm);
+    PointToPointRouterImpl(const StreetMap* sm, RouterMode mode);
     ~PointToPointRouterImpl();
     DeliveryResult generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
-        double& totalDistanceTravelled) const;
+        double& totalDistanceTravelled,
+        int& nodesExpanded) const;
+    DeliveryResult generatePointToPointPath(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled,
+        int& nodesExpanded) const;
+    void generatePointToPointRoutes(
+        const vector<RouteQuery>& queries,
+        vector<RouteResult>& results) const;
     
 private:
+    typedef StreetGraph::NodeId NodeId;
+    typedef StreetGraph::EdgeId EdgeId;
+    
     const StreetMap* sm;
+    RouterMode m_mode;
     
-    double getTotalDist(const list<StreetSegment>& route) const
+    DeliveryResult aStarPath(
+        NodeId source,
+        NodeId target,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled,
+        int& nodesExpanded) const;
+    DeliveryResult bidirectionalPath(
+        NodeId source,
+        NodeId target,
+        vector<RouteStep>& path,
+        int& nodesExpanded) const;
+    
+    double getTotalDist(const vector<RouteStep>& path) const
     {
+        const StreetGraph* g = sm->graph();
         double totalDist = 0;
         
-        for (auto p : route)
+        for (const auto& step : path)
         {
-            totalDist  += distanceEarthMiles(p.start, p.end);
+            totalDist += g->edgeLength(step.edge);
         }
         
         return totalDist;
     }
-    
-    
 };
 
 
-
-PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
-: sm(sm)
+PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm, RouterMode mode)
+: sm(sm), m_mode(mode)
 {
 }
 
@@ -52,97 +93,252 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
-        double& totalDistanceTravelled) const
+        double& totalDistanceTravelled,
+        int& nodesExpanded) const
+{
+    // Reused from query to query, like the search contexts
+    static thread_local vector<RouteStep> path;
+    
+    DeliveryResult result = generatePointToPointPath(start, end, path, totalDistanceTravelled, nodesExpanded);
+    if (result != DELIVERY_SUCCESS)
+        return result;
+    
+    const StreetGraph* g = sm->graph();
+    route.clear();
+    for (const RouteStep& step : path)
+        route.push_back(g->edgeSegment(step.from, step.edge));
+    
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointPath(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled,
+        int& nodesExpanded) const
 {
+    const StreetGraph* g = sm->graph();
+    nodesExpanded = 0;
+    
     // Validate GeoCoord
-    vector<StreetSegment> streetSegs;
-    if (!sm->getSegmentsThatStartWith(start, streetSegs))
+    NodeId source = g->nodeOf(start);
+    if (source == StreetGraph::NO_NODE)
         return BAD_COORD;
     
     if (start == end)
     {
-        route.clear();
+        path.clear();
+        totalDistanceTravelled = 0;
         return DELIVERY_SUCCESS;
     }
     
-    //  set q (open, )
-    set<GeoCoord> open;
+    NodeId target = g->nodeOf(end);
+    if (target == StreetGraph::NO_NODE)
+    {
+        cerr << "No route was found!" << endl;
+        return NO_ROUTE;
+    }
+    
+    // The other modes sum the path from start to end, in the same order
+    // A* builds up its g-scores, so every mode gives the same distance
+    const ContractionHierarchy* ch = sm->hierarchy();
+    DeliveryResult result = DELIVERY_SUCCESS;
+    if (m_mode == ROUTER_CH && ch != nullptr)
+        result = ch->route(source, target, forwardSearch, backwardSearch, path, nodesExpanded);
+    else if (m_mode == ROUTER_BIDIRECTIONAL)
+        result = bidirectionalPath(source, target, path, nodesExpanded);
+    else
+        return aStarPath(source, target, end, path, totalDistanceTravelled, nodesExpanded);
+    
+    if (result == DELIVERY_SUCCESS)
+        totalDistanceTravelled = getTotalDist(path);
+    return result;
+}
+
+DeliveryResult PointToPointRouterImpl::aStarPath(
+        NodeId source,
+        NodeId target,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled,
+        int& nodesExpanded) const
+{
+    const StreetGraph* g = sm->graph();
     
-    //  map <coord this, StreetSegment parentEdge>
-    map<GeoCoord, StreetSegment> cameFrom;
+    // A lower bound on the straight line distance to the end never
+    // overestimates, and neither do the landmark bounds, so the larger of
+    // them is the tightest admissible heuristic we have. The straight line
+    // bound is a few percent of the cost of the exact distance and within
+    // a tenth of a percent of it.
+    const Landmarks* lm = m_mode == ROUTER_ALT ? sm->landmarks() : nullptr;
+    CrowDistance toEnd(end.latitude, end.longitude);
+    auto heuristic = [&](NodeId n)
+    {
+        double h = toEnd.lowerBound(g->latitude(n), g->longitude(n));
+        if (lm != nullptr)
+            h = max(h, lm->lowerBound(n, target));
+        return h;
+    };
     
-    map<GeoCoord, Score> gScore;
-    map<GeoCoord, Score> fScore;
+    SearchContext& ctx = forwardSearch;
+    ctx.begin(g->nodeCount());
     
-    open.insert(start);
-    gScore.insert(pair<GeoCoord, Score>(start, 0));
-    fScore.insert(pair<GeoCoord, Score>(start, distanceEarthMiles(start, end)));
+    ctx.relax(source, 0, StreetGraph::NO_NODE, SearchContext::NO_EDGE, heuristic(source));
     
-    while (!open.empty())
+    while (!ctx.empty())
     {
-        // Get lowest fScore GeoCoord from open
-        GeoCoord current;
-        Score lowestF;
-        for (auto p : open)
-        {
-            if (fScore[p] < lowestF)
-            {
-                current = p;
-                lowestF = fScore[p];
-            }
-        }
+        // Get lowest fScore node from open
+        NodeId current = ctx.popMin();
+        nodesExpanded++;
         
-        if (current == end)
+        if (current == target)
         {
             // construct path
-            route.clear();
-            totalDistanceTravelled = gScore[current].score;
+            path.clear();
+            totalDistanceTravelled = ctx.g(current);
             
-            while (cameFrom[current].start != start)
+            while (current != source)
             {
-                route.push_front(cameFrom[current]);
-                current = cameFrom[current].start;
+                path.push_back(RouteStep{ctx.parent(current), ctx.parentEdge(current)});
+                current = ctx.parent(current);
             }
-            
-            route.push_front(cameFrom[current]);
+            reverse(path.begin(), path.end());
             
             return DELIVERY_SUCCESS;
         }
         
-        open.erase(open.find(current));
+        double currentG = ctx.g(current);
         
-        vector<StreetSegment> streetSegs;
-        sm->getSegmentsThatStartWith(current, streetSegs);
-        for ( auto p : streetSegs )
+        for (EdgeId e = g->firstEdge(current); e != g->endEdge(current); e++)
         {
-            Score tentativeG(gScore[current].score + distanceEarthMiles(current, p.end));
+            NodeId next = g->edgeTarget(e);
+            if (ctx.closed(next))
+                continue;
+            
+            double tentativeG = currentG + g->edgeLength(e);
             
-            if ( tentativeG < gScore[p.end] )
+            if (tentativeG < ctx.g(next))
             {
-                cameFrom[p.end] = p;
-                gScore[p.end] = tentativeG;
-                fScore[p.end] = Score(gScore[p.end].score + distanceEarthMiles(current, end));
-                
-                if (open.find(p.end) == open.end())
-                    open.insert(p.end);
+                ctx.relax(next, tentativeG, current, e, tentativeG + heuristic(next));
             }
         }
         
     }
     
-    cerr << "No route was found!" << endl;
     return NO_ROUTE;
                 
 }
 
+DeliveryResult PointToPointRouterImpl::bidirectionalPath(
+        NodeId source,
+        NodeId target,
+        vector<RouteStep>& path,
+        int& nodesExpanded) const
+{
+    const StreetGraph* g = sm->graph();
+    SearchContext& forward = forwardSearch;
+    SearchContext& backward = backwardSearch;
+    
+    // A* from both ends at once, each guided by the average of the
+    // straight line distance to the far end and (negated) from the near
+    // one. With these potentials both searches order nodes consistently,
+    // so the usual bidirectional Dijkstra stopping rule still holds.
+    CrowDistance fromSource(g->latitude(source), g->longitude(source));
+    CrowDistance toTarget(g->latitude(target), g->longitude(target));
+    auto potential = [&](NodeId n)
+    {
+        double lat = g->latitude(n), lon = g->longitude(n);
+        return (toTarget.miles(lat, lon) - fromSource.miles(lat, lon)) / 2;
+    };
+    
+    forward.begin(g->nodeCount());
+    backward.begin(g->nodeCount());
+    forward.relax(source, 0, StreetGraph::NO_NODE, SearchContext::NO_EDGE, potential(source));
+    backward.relax(target, 0, StreetGraph::NO_NODE, SearchContext::NO_EDGE, -potential(target));
+    
+    // The best path so far runs from the source to meetFrom, along
+    // meetEdge, then on to the target. meetEdge leaves meetFrom unless
+    // it was found by the backward search, in which case it leaves meetTo.
+    double best = source == target ? 0 : numeric_limits<double>::infinity();
+    NodeId meetFrom = source, meetTo = target;
+    EdgeId meetEdge = SearchContext::NO_EDGE;
+    bool meetBackward = false;
+    
+    while (!forward.empty() && !backward.empty() && forward.minKey() + backward.minKey() < best)
+    {
+        bool isForward = forward.minKey() <= backward.minKey();
+        SearchContext& ctx = isForward ? forward : backward;
+        SearchContext& other = isForward ? backward : forward;
+        double sign = isForward ? 1 : -1;
+        
+        NodeId current = ctx.popMin();
+        nodesExpanded++;
+        double currentG = ctx.g(current);
+        
+        for (EdgeId e = g->firstEdge(current); e != g->endEdge(current); e++)
+        {
+            NodeId next = g->edgeTarget(e);
+            double tentativeG = currentG + g->edgeLength(e);
+            
+            if (other.reached(next) && tentativeG + other.g(next) < best)
+            {
+                best = tentativeG + other.g(next);
+                meetFrom = isForward ? current : next;
+                meetTo = isForward ? next : current;
+                meetEdge = e;
+                meetBackward = !isForward;
+            }
+            
+            if (!ctx.closed(next) && tentativeG < ctx.g(next))
+                ctx.relax(next, tentativeG, current, e, tentativeG + sign * potential(next));
+        }
+    }
+    
+    if (best == numeric_limits<double>::infinity())
+        return NO_ROUTE;
+    
+    path.clear();
+    if (source == target)
+        return DELIVERY_SUCCESS;
+    
+    // Walk the forward half back from where the searches met
+    for (NodeId n = meetFrom; n != source; n = forward.parent(n))
+        path.push_back(RouteStep{forward.parent(n), forward.parentEdge(n)});
+    reverse(path.begin(), path.end());
+    
+    // The backward search's edges all point back towards the meeting
+    // point, so each is replaced by its twin running towards the target
+    EdgeId bridge = meetBackward ? g->reverseEdge(meetTo, meetEdge) : meetEdge;
+    path.push_back(RouteStep{meetFrom, bridge});
+    for (NodeId n = meetTo; n != target; n = backward.parent(n))
+        path.push_back(RouteStep{n, g->reverseEdge(backward.parent(n), backward.parentEdge(n))});
+    
+    return DELIVERY_SUCCESS;
+}
+
+void PointToPointRouterImpl::generatePointToPointRoutes(
+        const vector<RouteQuery>& queries,
+        vector<RouteResult>& results) const
+{
+    results.assign(queries.size(), RouteResult());
+    
+    // Each query writes only its own result
+    ThreadPool::shared().run(static_cast<int>(queries.size()), [&](int i, int)
+    {
+        RouteResult& r = results[i];
+        r.result = generatePointToPointRoute(queries[i].start, queries[i].end, r.route, r.distance, r.nodesExpanded);
+    });
+}
+
 //******************** PointToPointRouter functions ***************************
 
 // These functions simply delegate to PointToPointRouterImpl's functions.
 // You probably don't want to change any of this code.
 
-PointToPointRouter::PointToPointRouter(const StreetMap* sm)
+PointToPointRouter::PointToPointRouter(const StreetMap* sm, RouterMode mode)
 {
-    m_impl = new PointToPointRouterImpl(sm);
+    m_impl = new PointToPointRouterImpl(sm, mode);
 }
 
 PointToPointRouter::~PointToPointRouter()
@@ -156,6 +352,33 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const
 {
-    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+    int nodesExpanded;
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, nodesExpanded);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        int& nodesExpanded) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, nodesExpanded);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointPath(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<RouteStep>& path,
+        double& totalDistanceTravelled) const
+{
+    int nodesExpanded;
+    return m_impl->generatePointToPointPath(start, end, path, totalDistanceTravelled, nodesExpanded);
 }
 
+void PointToPointRouter::generatePointToPointRoutes(
+        const vector<RouteQuery>& queries,
+        vector<RouteResult>& results) const
+{
+    m_impl->generatePointToPointRoutes(queries, results);
+}
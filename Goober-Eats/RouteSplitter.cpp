@@ -0,0 +1,286 @@
+#include "RouteSplitter.h"
+#include "TourOptimizer.h"
+#include <algorithm>
+
+using namespace std;
+
+RouteSplitter::RouteSplitter(const vector<double>& cost, int n,
+                             const vector<double>& demand, double capacity)
+: m_cost(cost), m_n(n), m_demand(demand), m_capacity(capacity)
+{
+    m_demand[0] = 0;
+}
+
+bool RouteSplitter::split(int maxRoutes, vector<vector<int>>& routes) const
+{
+    routes.clear();
+    if (maxRoutes < 1)
+        return m_n <= 1;
+    for (int s = 1; s < m_n; s++)
+    {
+        if (m_demand[s] > m_capacity)
+            return false;
+    }
+
+    buildBySavings(routes);
+    if (!reduceRoutes(routes, maxRoutes) && !packByDemand(routes, maxRoutes))
+        return false;
+
+    vector<double> loads;
+    for (const vector<int>& route : routes)
+        loads.push_back(load(route));
+    while (improveRelocate(routes, loads) || improveExchange(routes, loads))
+        ;
+
+    // Relocating can empty a route
+    routes.erase(remove_if(routes.begin(), routes.end(),
+                           [](const vector<int>& route) { return route.empty(); }),
+                 routes.end());
+    return true;
+}
+
+double RouteSplitter::routeCost(const vector<int>& route) const
+{
+    double total = 0;
+    int prev = 0;
+    for (int stop : route)
+    {
+        total += cost(prev, stop);
+        prev = stop;
+    }
+    return total + cost(prev, 0);
+}
+
+double RouteSplitter::load(const vector<int>& route) const
+{
+    double total = 0;
+    for (int stop : route)
+        total += m_demand[stop];
+    return total;
+}
+
+void RouteSplitter::buildBySavings(vector<vector<int>>& routes) const
+{
+    // Going i -> j directly rather than i -> depot -> j saves this much
+    struct Saving
+    {
+        double value;
+        int i;
+        int j;
+    };
+    vector<Saving> savings;
+    for (int i = 1; i < m_n; i++)
+    {
+        for (int j = i + 1; j < m_n; j++)
+        {
+            double value = cost(i, 0) + cost(0, j) - cost(i, j);
+            if (value > TourOptimizer::MIN_GAIN)
+                savings.push_back(Saving{value, i, j});
+        }
+    }
+    stable_sort(savings.begin(), savings.end(),
+                [](const Saving& a, const Saving& b) { return a.value > b.value; });
+
+    routes.assign(m_n - 1, vector<int>());
+    vector<int> routeOf(m_n);
+    vector<double> loads(m_n - 1);
+    for (int s = 1; s < m_n; s++)
+    {
+        routes[s - 1].push_back(s);
+        routeOf[s] = s - 1;
+        loads[s - 1] = m_demand[s];
+    }
+
+    for (const Saving& saving : savings)
+    {
+        int a = routeOf[saving.i];
+        int b = routeOf[saving.j];
+        if (a == b || loads[a] + loads[b] > m_capacity)
+            continue;
+
+        // Only stops at the end of a route can be joined to another
+        vector<int>& first = routes[a];
+        vector<int>& second = routes[b];
+        if ((first.front() != saving.i && first.back() != saving.i) ||
+            (second.front() != saving.j && second.back() != saving.j))
+            continue;
+
+        // Costs are taken as symmetric, so a route can be turned round
+        // to put i last and j first
+        if (first.back() != saving.i)
+            reverse(first.begin(), first.end());
+        if (second.front() != saving.j)
+            reverse(second.begin(), second.end());
+        for (int stop : second)
+            routeOf[stop] = a;
+        first.insert(first.end(), second.begin(), second.end());
+        second.clear();
+        loads[a] += loads[b];
+        loads[b] = 0;
+    }
+
+    routes.erase(remove_if(routes.begin(), routes.end(),
+                           [](const vector<int>& route) { return route.empty(); }),
+                 routes.end());
+}
+
+bool RouteSplitter::reduceRoutes(vector<vector<int>>& routes, int maxRoutes) const
+{
+    vector<double> loads;
+    for (const vector<int>& route : routes)
+        loads.push_back(load(route));
+
+    while (static_cast<int>(routes.size()) > maxRoutes)
+    {
+        int lightest = static_cast<int>(min_element(loads.begin(), loads.end()) - loads.begin());
+        vector<int> stops;
+        stops.swap(routes[lightest]);
+        loads[lightest] = 0;
+        for (int stop : stops)
+        {
+            if (!insertCheapest(routes, loads, stop, lightest))
+                return false;
+        }
+
+        routes.erase(routes.begin() + lightest);
+        loads.erase(loads.begin() + lightest);
+    }
+    return true;
+}
+
+bool RouteSplitter::packByDemand(vector<vector<int>>& routes, int maxRoutes) const
+{
+    vector<int> stops;
+    for (int s = 1; s < m_n; s++)
+        stops.push_back(s);
+    stable_sort(stops.begin(), stops.end(),
+                [this](int a, int b) { return m_demand[a] > m_demand[b]; });
+
+    routes.assign(maxRoutes, vector<int>());
+    vector<double> loads(maxRoutes, 0);
+    for (int stop : stops)
+    {
+        if (!insertCheapest(routes, loads, stop, -1))
+            return false;
+    }
+
+    routes.erase(remove_if(routes.begin(), routes.end(),
+                           [](const vector<int>& route) { return route.empty(); }),
+                 routes.end());
+    return true;
+}
+
+bool RouteSplitter::insertCheapest(vector<vector<int>>& routes, vector<double>& loads,
+                                   int stop, int skip) const
+{
+    int bestRoute = -1;
+    int bestPos = 0;
+    double bestCost = 0;
+    int nRoutes = static_cast<int>(routes.size());
+    for (int r = 0; r < nRoutes; r++)
+    {
+        if (r == skip || loads[r] + m_demand[stop] > m_capacity)
+            continue;
+
+        // Position p puts stop before routes[r][p]
+        int len = static_cast<int>(routes[r].size());
+        for (int p = 0; p <= len; p++)
+        {
+            int prev = before(routes[r], p);
+            int next = p < len ? routes[r][p] : 0;
+            double added = cost(prev, stop) + cost(stop, next) - cost(prev, next);
+            if (bestRoute == -1 || added < bestCost)
+            {
+                bestRoute = r;
+                bestPos = p;
+                bestCost = added;
+            }
+        }
+    }
+
+    if (bestRoute == -1)
+        return false;
+    routes[bestRoute].insert(routes[bestRoute].begin() + bestPos, stop);
+    loads[bestRoute] += m_demand[stop];
+    return true;
+}
+
+bool RouteSplitter::improveRelocate(vector<vector<int>>& routes, vector<double>& loads) const
+{
+    int nRoutes = static_cast<int>(routes.size());
+    for (int a = 0; a < nRoutes; a++)
+    {
+        int aLen = static_cast<int>(routes[a].size());
+        for (int i = 0; i < aLen; i++)
+        {
+            int stop = routes[a][i];
+            int prev = before(routes[a], i);
+            int next = after(routes[a], i);
+            double removed = cost(prev, stop) + cost(stop, next) - cost(prev, next);
+
+            for (int b = 0; b < nRoutes; b++)
+            {
+                if (b == a || routes[b].empty() || loads[b] + m_demand[stop] > m_capacity)
+                    continue;
+
+                int bLen = static_cast<int>(routes[b].size());
+                for (int p = 0; p <= bLen; p++)
+                {
+                    int bPrev = before(routes[b], p);
+                    int bNext = p < bLen ? routes[b][p] : 0;
+                    double added = cost(bPrev, stop) + cost(stop, bNext) - cost(bPrev, bNext);
+                    if (removed - added > TourOptimizer::MIN_GAIN)
+                    {
+                        routes[a].erase(routes[a].begin() + i);
+                        routes[b].insert(routes[b].begin() + p, stop);
+                        loads[a] -= m_demand[stop];
+                        loads[b] += m_demand[stop];
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool RouteSplitter::improveExchange(vector<vector<int>>& routes, vector<double>& loads) const
+{
+    int nRoutes = static_cast<int>(routes.size());
+    for (int a = 0; a < nRoutes; a++)
+    {
+        int aLen = static_cast<int>(routes[a].size());
+        for (int b = a + 1; b < nRoutes; b++)
+        {
+            int bLen = static_cast<int>(routes[b].size());
+            for (int i = 0; i < aLen; i++)
+            {
+                int s = routes[a][i];
+                int aPrev = before(routes[a], i);
+                int aNext = after(routes[a], i);
+
+                for (int j = 0; j < bLen; j++)
+                {
+                    int t = routes[b][j];
+                    double shift = m_demand[t] - m_demand[s];
+                    if (loads[a] + shift > m_capacity || loads[b] - shift > m_capacity)
+                        continue;
+
+                    int bPrev = before(routes[b], j);
+                    int bNext = after(routes[b], j);
+                    double delta = cost(aPrev, t) + cost(t, aNext) - cost(aPrev, s) - cost(s, aNext) +
+                                   cost(bPrev, s) + cost(s, bNext) - cost(bPrev, t) - cost(t, bNext);
+                    if (delta < -TourOptimizer::MIN_GAIN)
+                    {
+                        routes[a][i] = t;
+                        routes[b][j] = s;
+                        loads[a] += shift;
+                        loads[b] -= shift;
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
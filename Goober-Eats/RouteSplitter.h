@@ -0,0 +1,82 @@
+//
+//  RouteSplitter.h
+//  Goober-Eats
+//
+
+#ifndef RouteSplitter_h
+#define RouteSplitter_h
+
+#include <vector>
+
+// Shares the stops of a delivery round between several vehicles, each
+// leaving from and returning to the depot (stop 0) and carrying at most a
+// fixed capacity, given the cost of travelling between every pair of stops
+// and each stop's demand.
+//
+// Routes are built with the Clarke-Wright savings method: every stop starts
+// on a route of its own, and routes are joined end to end, the pairs of
+// stops whose joining saves the most coming first, as long as the joined
+// route fits in a vehicle. If that leaves more routes than vehicles, the
+// lightest routes are broken up and their stops put wherever they cost
+// least, or failing that the stops are packed afresh, largest demand
+// first, each going wherever it costs least in a vehicle with room for it.
+// Stops are then moved (relocate) and swapped (exchange) between routes for
+// as long as that shortens the total. Ordering each route on its own is
+// left to TourOptimizer.
+
+class RouteSplitter
+{
+public:
+    // cost holds n*n entries; cost[i*n + j] is the cost from stop i to j.
+    // demand holds n entries, the depot's being ignored.
+    RouteSplitter(const std::vector<double>& cost, int n,
+                  const std::vector<double>& demand, double capacity);
+
+    // Share stops 1 .. n-1 between at most maxRoutes routes, each a visiting
+    // order that leaves out the depot. False if they couldn't be fitted into
+    // that many vehicles.
+    bool split(int maxRoutes, std::vector<std::vector<int>>& routes) const;
+
+    // Cost of a route from the depot through its stops and back
+    double routeCost(const std::vector<int>& route) const;
+
+    // Total demand of a route's stops
+    double load(const std::vector<int>& route) const;
+
+private:
+    std::vector<double> m_cost;
+    int m_n;
+    std::vector<double> m_demand;
+    double m_capacity;
+
+    double cost(int from, int to) const { return m_cost[from * m_n + to]; }
+
+    // The stop before or after position i of route, the depot at either end
+    int before(const std::vector<int>& route, int i) const { return i > 0 ? route[i - 1] : 0; }
+    int after(const std::vector<int>& route, int i) const
+    {
+        return i + 1 < static_cast<int>(route.size()) ? route[i + 1] : 0;
+    }
+
+    void buildBySavings(std::vector<std::vector<int>>& routes) const;
+
+    // Break up routes until there are at most maxRoutes; false if a stop
+    // has nowhere to go
+    bool reduceRoutes(std::vector<std::vector<int>>& routes, int maxRoutes) const;
+
+    // Start again with maxRoutes empty routes, putting each stop, largest
+    // demand first, wherever it costs least and fits, for when the routes
+    // savings made won't break up into few enough
+    bool packByDemand(std::vector<std::vector<int>>& routes, int maxRoutes) const;
+
+    // Put stop into whichever route and position costs least and has room,
+    // leaving route skip alone; false if none has room
+    bool insertCheapest(std::vector<std::vector<int>>& routes, std::vector<double>& loads,
+                        int stop, int skip) const;
+
+    // Take the first move found that shortens the total; false if none does
+    bool improveRelocate(std::vector<std::vector<int>>& routes, std::vector<double>& loads) const;
+    bool improveExchange(std::vector<std::vector<int>>& routes, std::vector<double>& loads) const;
+};
+
+#endif /* RouteSplitter_h */
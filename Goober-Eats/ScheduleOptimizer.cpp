@@ -0,0 +1,201 @@
+#include "ScheduleOptimizer.h"
+#include "TourOptimizer.h"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+constexpr double ScheduleOptimizer::LATE_TOLERANCE;
+
+ScheduleOptimizer::ScheduleOptimizer(const vector<double>& minutes, int n,
+                                     const vector<double>& earliest, const vector<double>& latest,
+                                     double startMinute, double serviceMinutes)
+: m_minutes(minutes), m_n(n), m_earliest(earliest), m_latest(latest),
+  m_startMinute(startMinute), m_serviceMinutes(serviceMinutes)
+{
+    // The vehicle can get back to the depot whenever it likes
+    m_earliest[0] = -numeric_limits<double>::infinity();
+    m_latest[0] = numeric_limits<double>::infinity();
+}
+
+double ScheduleOptimizer::optimize(vector<int>& order, chrono::steady_clock::time_point deadline) const
+{
+    vector<int> tour;
+    insertAll(tour);
+    while (chrono::steady_clock::now() < deadline && improveRelocate(tour, deadline))
+        ;
+
+    order.assign(tour.begin() + 1, tour.end() - 1);
+    return travelMinutes(order);
+}
+
+double ScheduleOptimizer::schedule(const vector<int>& order, vector<StopTime>& times) const
+{
+    vector<int> tour(1, 0);
+    tour.insert(tour.end(), order.begin(), order.end());
+    tour.push_back(0);
+    Timeline t;
+    buildTimeline(tour, t);
+
+    times.clear();
+    int m = static_cast<int>(tour.size());
+    for (int k = 1; k + 1 < m; k++)
+        times.push_back(StopTime{t.arrival[k], t.start[k], t.start[k] > m_latest[tour[k]] + LATE_TOLERANCE});
+    return t.arrival.back();
+}
+
+double ScheduleOptimizer::travelMinutes(const vector<int>& order) const
+{
+    double total = 0;
+    int prev = 0;
+    for (int stop : order)
+    {
+        total += minutes(prev, stop);
+        prev = stop;
+    }
+    return total + minutes(prev, 0);
+}
+
+void ScheduleOptimizer::buildTimeline(const vector<int>& tour, Timeline& t) const
+{
+    int m = static_cast<int>(tour.size());
+    t.arrival.resize(m);
+    t.start.resize(m);
+    t.slack.resize(m);
+
+    t.arrival[0] = m_startMinute;
+    t.start[0] = m_startMinute;
+    for (int k = 1; k < m; k++)
+    {
+        t.arrival[k] = departure(t, k - 1) + minutes(tour[k - 1], tour[k]);
+        t.start[k] = max(t.arrival[k], m_earliest[tour[k]]);
+    }
+
+    // Delaying stop k delays the next one less by however long it would
+    // have waited there
+    t.slack[m - 1] = numeric_limits<double>::infinity();
+    for (int k = m - 2; k >= 0; k--)
+    {
+        double margin = max(m_latest[tour[k]] - t.start[k], 0.0);
+        t.slack[k] = min(margin, t.start[k + 1] - t.arrival[k + 1] + t.slack[k + 1]);
+    }
+}
+
+bool ScheduleOptimizer::fits(const vector<int>& tour, const Timeline& t, int k, int stop, double limit) const
+{
+    double begin = max(departure(t, k) + minutes(tour[k], stop), m_earliest[stop]);
+    if (begin > limit + LATE_TOLERANCE)
+        return false;
+
+    int next = tour[k + 1];
+    double nextStart = max(begin + m_serviceMinutes + minutes(stop, next), m_earliest[next]);
+    return nextStart - t.start[k + 1] <= t.slack[k + 1] + LATE_TOLERANCE;
+}
+
+double ScheduleOptimizer::lateness(const vector<int>& tour) const
+{
+    Timeline t;
+    buildTimeline(tour, t);
+    double total = 0;
+    int m = static_cast<int>(tour.size());
+    for (int k = 1; k + 1 < m; k++)
+        total += max(t.start[k] - m_latest[tour[k]], 0.0);
+    return total;
+}
+
+void ScheduleOptimizer::insertAll(vector<int>& tour) const
+{
+    // Tightest deadlines first, then earliest openings
+    vector<int> stops;
+    for (int s = 1; s < m_n; s++)
+        stops.push_back(s);
+    stable_sort(stops.begin(), stops.end(), [this](int a, int b) {
+        if (m_latest[a] != m_latest[b])
+            return m_latest[a] < m_latest[b];
+        return m_earliest[a] < m_earliest[b];
+    });
+
+    tour.assign(2, 0);
+    Timeline t;
+    for (int stop : stops)
+    {
+        buildTimeline(tour, t);
+        int m = static_cast<int>(tour.size());
+        int best = -1;
+        double bestAdded = 0;
+        for (int k = 0; k + 1 < m; k++)
+        {
+            double added = insertionMinutes(tour, k, stop);
+            if ((best == -1 || added < bestAdded) && fits(tour, t, k, stop, m_latest[stop]))
+            {
+                best = k;
+                bestAdded = added;
+            }
+        }
+
+        // With nowhere it fits, try it everywhere and keep the least late;
+        // slow, but only for stops that can't be served on time
+        if (best == -1)
+        {
+            double bestLateness = 0;
+            vector<int> candidate;
+            for (int k = 0; k + 1 < m; k++)
+            {
+                candidate = tour;
+                candidate.insert(candidate.begin() + k + 1, stop);
+                double late = lateness(candidate);
+                double added = insertionMinutes(tour, k, stop);
+                if (best == -1 || late < bestLateness - TourOptimizer::MIN_GAIN ||
+                    (late <= bestLateness + TourOptimizer::MIN_GAIN && added < bestAdded))
+                {
+                    best = k;
+                    bestLateness = late;
+                    bestAdded = added;
+                }
+            }
+        }
+
+        tour.insert(tour.begin() + best + 1, stop);
+    }
+}
+
+bool ScheduleOptimizer::improveRelocate(vector<int>& tour, chrono::steady_clock::time_point deadline) const
+{
+    Timeline t;
+    buildTimeline(tour, t);
+    vector<int> rest;
+    Timeline restTimes;
+
+    int m = static_cast<int>(tour.size());
+    for (int i = 1; i + 1 < m; i++)
+    {
+        if (chrono::steady_clock::now() >= deadline)
+            return false;
+
+        // The stop may end up no later than its window closes, or than it
+        // starts now if that's later still
+        int stop = tour[i];
+        double limit = max(m_latest[stop], t.start[i]);
+        double removed = minutes(tour[i - 1], stop) + minutes(stop, tour[i + 1]) -
+                         minutes(tour[i - 1], tour[i + 1]);
+
+        // One pass over the tour without the stop, and then every place it
+        // could go back in is checked in constant time
+        rest = tour;
+        rest.erase(rest.begin() + i);
+        buildTimeline(rest, restTimes);
+        for (int k = 0; k + 2 < m; k++)
+        {
+            if (k == i - 1)
+                continue;
+            if (removed - insertionMinutes(rest, k, stop) > TourOptimizer::MIN_GAIN &&
+                fits(rest, restTimes, k, stop, limit))
+            {
+                rest.insert(rest.begin() + k + 1, stop);
+                tour.swap(rest);
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,108 @@
+//
+//  ScheduleOptimizer.h
+//  Goober-Eats
+//
+
+#ifndef ScheduleOptimizer_h
+#define ScheduleOptimizer_h
+
+#include "provided.h"
+#include <vector>
+#include <chrono>
+
+// Orders the stops of a delivery tour so that each is reached within its
+// time window, given the minutes it takes to travel between every pair of
+// them, while keeping the total travel time down. Stop 0 is the depot,
+// which the vehicle leaves at a set minute and returns to at the end. A
+// vehicle that arrives before a window opens waits for it.
+//
+// The tour is built by inserting the stops one at a time, the one whose
+// window closes first coming first, each where it adds least travel time
+// without making any stop late. It is then improved by moving single stops
+// elsewhere (relocate) for as long as that saves time and time allows.
+//
+// Each candidate is checked in constant time using the forward time slack
+// of the tour: for every stop, how much later it could be started without
+// pushing any stop from there on past its window, waits along the way
+// soaking up part of the delay. Inserting a stop only delays the rest of
+// the tour from the stop after it, so it fits if that delay is within the
+// slack there. Taking a stop out never delays anything, travel times being
+// shortest paths.
+
+class ScheduleOptimizer
+{
+public:
+    // minutes holds n*n entries; minutes[i*n + j] is the time from stop i
+    // to j. earliest and latest hold each stop's window, the depot's being
+    // ignored. The vehicle leaves the depot at startMinute and spends
+    // serviceMinutes at each other stop.
+    ScheduleOptimizer(const std::vector<double>& minutes, int n,
+                      const std::vector<double>& earliest, const std::vector<double>& latest,
+                      double startMinute, double serviceMinutes);
+
+    // Set order to a visiting order of stops 1 .. n-1, stopping work on it
+    // at deadline. If there's no fitting a stop in without someone being
+    // late, it goes where it makes the tour least late, and later moves
+    // never make a stop later than it already is. Returns the total travel
+    // time.
+    double optimize(std::vector<int>& order, std::chrono::steady_clock::time_point deadline) const;
+
+    // The schedule along order, one StopTime per stop of it; returns the
+    // minute the vehicle is back at the depot
+    double schedule(const std::vector<int>& order, std::vector<StopTime>& times) const;
+
+    // Total time spent travelling along order, there and back
+    double travelMinutes(const std::vector<int>& order) const;
+
+private:
+    // A stop this far past its latest counts as late
+    static constexpr double LATE_TOLERANCE = 1e-9;
+
+    std::vector<double> m_minutes;
+    int m_n;
+    std::vector<double> m_earliest;
+    std::vector<double> m_latest;
+    double m_startMinute;
+    double m_serviceMinutes;
+
+    double minutes(int from, int to) const { return m_minutes[from * m_n + to]; }
+
+    // Times along a whole tour: the depot, the stops, then the depot again.
+    // slack[k] is how much later tour[k] could start without any stop from
+    // k on starting later than its latest, or later than it already does
+    // if it's late already.
+    struct Timeline
+    {
+        std::vector<double> arrival;
+        std::vector<double> start;
+        std::vector<double> slack;
+    };
+
+    void buildTimeline(const std::vector<int>& tour, Timeline& t) const;
+
+    // When the vehicle leaves the k'th stop of a tour timed by t
+    double departure(const Timeline& t, int k) const
+    {
+        return t.start[k] + (k > 0 ? m_serviceMinutes : 0);
+    }
+
+    // Whether stop can go between tour[k] and tour[k+1], starting no later
+    // than limit and delaying no other stop more than the slack allows
+    bool fits(const std::vector<int>& tour, const Timeline& t, int k, int stop, double limit) const;
+
+    // Time added by putting stop between tour[k] and tour[k+1]
+    double insertionMinutes(const std::vector<int>& tour, int k, int stop) const
+    {
+        return minutes(tour[k], stop) + minutes(stop, tour[k + 1]) - minutes(tour[k], tour[k + 1]);
+    }
+
+    // Total of how late every stop of a whole tour starts
+    double lateness(const std::vector<int>& tour) const;
+
+    void insertAll(std::vector<int>& tour) const;
+
+    // Take the first relocation found that saves time; false if none does
+    bool improveRelocate(std::vector<int>& tour, std::chrono::steady_clock::time_point deadline) const;
+};
+
+#endif /* ScheduleOptimizer_h */
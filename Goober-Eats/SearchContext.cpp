@@ -0,0 +1,110 @@
+#include "SearchContext.h"
+
+using namespace std;
+
+const SearchContext::EdgeId SearchContext::NO_EDGE;
+const uint32_t SearchContext::CLOSED;
+
+SearchContext::SearchContext()
+: m_generation(0)
+{
+}
+
+void SearchContext::begin(int nNodes)
+{
+    // New nodes get stamp 0, which no generation ever uses
+    if (static_cast<size_t>(nNodes) > m_nodes.size())
+    {
+        m_nodes.resize(nNodes, NodeState());
+        m_heap.reserve(nNodes);
+    }
+
+    m_heap.clear();
+
+    // When the counter wraps, old stamps could come back to life, so this
+    // once in four billion searches we really do clear them
+    if (++m_generation == 0)
+    {
+        for (NodeState& s : m_nodes)
+            s.stamp = 0;
+        m_generation = 1;
+    }
+}
+
+bool SearchContext::relax(NodeId n, double g, NodeId from, EdgeId e, double key)
+{
+    NodeState& s = m_nodes[n];
+
+    if (s.stamp != m_generation)
+    {
+        s.stamp = m_generation;
+        s.g = g;
+        s.parent = from;
+        s.parentEdge = e;
+        m_heap.push_back(HeapItem{key, n});
+        s.heapPos = static_cast<uint32_t>(m_heap.size() - 1);
+        siftUp(s.heapPos);
+        return true;
+    }
+
+    if (s.heapPos == CLOSED || !(g < s.g))
+        return false;
+
+    // A lower g with the same heuristic means a lower key, so the node can
+    // only move up
+    s.g = g;
+    s.parent = from;
+    s.parentEdge = e;
+    m_heap[s.heapPos].key = key;
+    siftUp(s.heapPos);
+    return true;
+}
+
+SearchContext::NodeId SearchContext::popMin()
+{
+    NodeId n = m_heap.front().node;
+    m_nodes[n].heapPos = CLOSED;
+
+    HeapItem last = m_heap.back();
+    m_heap.pop_back();
+    if (!m_heap.empty())
+    {
+        place(0, last);
+        siftDown(0);
+    }
+
+    return n;
+}
+
+void SearchContext::siftUp(size_t i)
+{
+    HeapItem item = m_heap[i];
+    while (i > 0)
+    {
+        size_t up = (i - 1) / 2;
+        if (!(item.key < m_heap[up].key))
+            break;
+        place(i, m_heap[up]);
+        i = up;
+    }
+    place(i, item);
+}
+
+void SearchContext::siftDown(size_t i)
+{
+    HeapItem item = m_heap[i];
+    size_t n = m_heap.size();
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && m_heap[child + 1].key < m_heap[child].key)
+            child++;
+        if (!(m_heap[child].key < item.key))
+            break;
+        place(i, m_heap[child]);
+        i = child;
+    }
+    place(i, item);
+}
@@ -0,0 +1,100 @@
+//
+//  SearchContext.h
+//  Goober-Eats
+//
+
+#ifndef SearchContext_h
+#define SearchContext_h
+
+#include "StreetGraph.h"
+#include <vector>
+#include <limits>
+#include <cstdint>
+
+// Per-node state for one shortest-path search over a StreetGraph (g-score,
+// the edge each node was reached by, and where it sits in the open heap),
+// plus the open heap itself.
+//
+// Everything is kept in flat arrays indexed by NodeId that are reused from
+// search to search. Rather than clearing them, begin() bumps a generation
+// number; a node whose stamp is from an older generation counts as not yet
+// reached. Once the arrays have grown to the size of the graph, a search
+// does no heap allocation at all.
+//
+// A SearchContext is not safe to share between threads; give each thread
+// its own.
+
+class SearchContext
+{
+public:
+    typedef StreetGraph::NodeId NodeId;
+    typedef StreetGraph::EdgeId EdgeId;
+
+    static const EdgeId NO_EDGE = 0xFFFFFFFF;
+
+    SearchContext();
+
+    // Start a new search over a graph with nNodes nodes
+    void begin(int nNodes);
+
+    bool reached(NodeId n) const { return m_nodes[n].stamp == m_generation; }
+    bool closed(NodeId n) const { return reached(n) && m_nodes[n].heapPos == CLOSED; }
+
+    // Infinity for nodes not reached yet
+    double g(NodeId n) const
+    {
+        return reached(n) ? m_nodes[n].g : std::numeric_limits<double>::infinity();
+    }
+
+    // The node n was reached from, and the edge taken; NO_NODE and NO_EDGE
+    // for the node a search starts at
+    NodeId parent(NodeId n) const { return m_nodes[n].parent; }
+    EdgeId parentEdge(NodeId n) const { return m_nodes[n].parentEdge; }
+
+    // Record that n can be reached with score g over edge e from node from,
+    // and queue it (or move it up the queue) with the given key. Does
+    // nothing and returns false if n is closed or g is no improvement.
+    bool relax(NodeId n, double g, NodeId from, EdgeId e, double key);
+
+    bool empty() const { return m_heap.empty(); }
+    double minKey() const { return m_heap.front().key; }
+
+    // Remove the node with the lowest key from the queue and close it
+    NodeId popMin();
+
+    SearchContext(const SearchContext&) = delete;
+    SearchContext& operator=(const SearchContext&) = delete;
+
+private:
+    static const uint32_t CLOSED = 0xFFFFFFFF;
+
+    struct NodeState
+    {
+        double g;
+        NodeId parent;
+        EdgeId parentEdge;
+        uint32_t stamp;         // generation this state belongs to
+        uint32_t heapPos;       // index in m_heap, or CLOSED
+    };
+
+    struct HeapItem
+    {
+        double key;
+        NodeId node;
+    };
+
+    std::vector<NodeState> m_nodes;
+    std::vector<HeapItem> m_heap;   // binary min-heap on key
+    uint32_t m_generation;
+
+    void place(size_t i, const HeapItem& item)
+    {
+        m_heap[i] = item;
+        m_nodes[item.node].heapPos = static_cast<uint32_t>(i);
+    }
+
+    void siftUp(size_t i);
+    void siftDown(size_t i);
+};
+
+#endif /* SearchContext_h */
@@ -0,0 +1,255 @@
+#include "SpatialIndex.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+SpatialIndex::SpatialIndex()
+: m_graph(nullptr), m_xScale(1), m_minX(0), m_minY(0), m_cellSize(1), m_cols(0), m_rows(0)
+{
+}
+
+void SpatialIndex::build(const StreetGraph& g)
+{
+    m_graph = &g;
+    m_nodes.clear();
+    m_segments.clear();
+    m_cols = m_rows = 0;
+
+    NodeId nNodes = static_cast<NodeId>(g.nodeCount());
+    if (nNodes == 0)
+        return;
+
+    double minLat = g.latitude(0), maxLat = minLat;
+    double minLon = g.longitude(0), maxLon = minLon;
+    for (NodeId n = 1; n < nNodes; n++)
+    {
+        minLat = min(minLat, g.latitude(n));
+        maxLat = max(maxLat, g.latitude(n));
+        minLon = min(minLon, g.longitude(n));
+        maxLon = max(maxLon, g.longitude(n));
+    }
+
+    m_xScale = cos((minLat + maxLat) / 2 * M_PI / 180);
+    m_minX = projectX(minLon);
+    m_minY = minLat;
+    double width = max(projectX(maxLon) - m_minX, 1e-6);
+    double height = max(maxLat - minLat, 1e-6);
+
+    // Each segment is stored once, from its lower-numbered end
+    size_t nSegments = 0;
+    for (NodeId n = 0; n < nNodes; n++)
+    {
+        for (EdgeId e = g.firstEdge(n); e != g.endEdge(n); e++)
+        {
+            if (g.edgeTarget(e) > n)
+                nSegments++;
+        }
+    }
+
+    // Aim for about two segments per cell, but keep the grid itself small
+    // however oddly shaped the map is
+    m_cellSize = sqrt(width * height / max<size_t>(1, nSegments / 2));
+    for (;;)
+    {
+        m_cols = static_cast<int>(width / m_cellSize) + 1;
+        m_rows = static_cast<int>(height / m_cellSize) + 1;
+        if (static_cast<size_t>(m_cols) * m_rows <= 4 * nSegments + 64)
+            break;
+        m_cellSize *= 2;
+    }
+    size_t nCells = static_cast<size_t>(m_cols) * m_rows;
+
+    // Nodes, one cell each
+    m_nodeOffsets.assign(nCells + 1, 0);
+    vector<uint32_t> nodeCell(nNodes);
+    for (NodeId n = 0; n < nNodes; n++)
+    {
+        nodeCell[n] = row(g.latitude(n)) * m_cols + column(projectX(g.longitude(n)));
+        m_nodeOffsets[nodeCell[n] + 1]++;
+    }
+    for (size_t c = 0; c < nCells; c++)
+        m_nodeOffsets[c + 1] += m_nodeOffsets[c];
+    m_nodes.resize(nNodes);
+    vector<uint32_t> next(m_nodeOffsets.begin(), m_nodeOffsets.end() - 1);
+    for (NodeId n = 0; n < nNodes; n++)
+        m_nodes[next[nodeCell[n]]++] = n;
+
+    // Segments, in every cell their bounding box touches. The first pass
+    // counts and the second fills.
+    m_segmentOffsets.assign(nCells + 1, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            for (size_t c = 0; c < nCells; c++)
+                m_segmentOffsets[c + 1] += m_segmentOffsets[c];
+            m_segments.resize(m_segmentOffsets[nCells]);
+            next.assign(m_segmentOffsets.begin(), m_segmentOffsets.end() - 1);
+        }
+
+        for (NodeId n = 0; n < nNodes; n++)
+        {
+            for (EdgeId e = g.firstEdge(n); e != g.endEdge(n); e++)
+            {
+                NodeId t = g.edgeTarget(e);
+                if (t <= n)
+                    continue;
+
+                int c0 = column(projectX(g.longitude(n))), c1 = column(projectX(g.longitude(t)));
+                int r0 = row(g.latitude(n)), r1 = row(g.latitude(t));
+                for (int r = min(r0, r1); r <= max(r0, r1); r++)
+                {
+                    for (int c = min(c0, c1); c <= max(c0, c1); c++)
+                    {
+                        size_t cell = static_cast<size_t>(r) * m_cols + c;
+                        if (pass == 0)
+                            m_segmentOffsets[cell + 1]++;
+                        else
+                            m_segments[next[cell]++] = Entry{n, e};
+                    }
+                }
+            }
+        }
+    }
+}
+
+int SpatialIndex::column(double x) const
+{
+    return max(0, min(m_cols - 1, static_cast<int>(floor((x - m_minX) / m_cellSize))));
+}
+
+int SpatialIndex::row(double y) const
+{
+    return max(0, min(m_rows - 1, static_cast<int>(floor((y - m_minY) / m_cellSize))));
+}
+
+template <typename Visit>
+bool SpatialIndex::visitRing(int col, int row, int r, Visit visit) const
+{
+    if (col - r < 0 && row - r < 0 && col + r >= m_cols && row + r >= m_rows)
+        return false;
+
+    auto visitCell = [&](int c, int rw)
+    {
+        if (c >= 0 && c < m_cols && rw >= 0 && rw < m_rows)
+            visit(static_cast<size_t>(rw) * m_cols + c);
+    };
+
+    if (r == 0)
+    {
+        visitCell(col, row);
+        return true;
+    }
+
+    // Top and bottom rows of the ring, then the two sides between them
+    for (int c = col - r; c <= col + r; c++)
+    {
+        visitCell(c, row - r);
+        visitCell(c, row + r);
+    }
+    for (int rw = row - r + 1; rw <= row + r - 1; rw++)
+    {
+        visitCell(col - r, rw);
+        visitCell(col + r, rw);
+    }
+    return true;
+}
+
+SpatialIndex::NodeId SpatialIndex::nearestNode(double latitude, double longitude) const
+{
+    if (m_nodes.empty())
+        return StreetGraph::NO_NODE;
+
+    double x = projectX(longitude);
+    double y = latitude;
+    int col = column(x);
+    int rw = row(y);
+
+    NodeId best = StreetGraph::NO_NODE;
+    double bestDist2 = numeric_limits<double>::infinity();
+
+    // Anything in ring r is at least (r-1) cells away
+    for (int r = 0; ; r++)
+    {
+        double reach = max(0, r - 1) * m_cellSize;
+        if (bestDist2 <= reach * reach)
+            break;
+
+        bool inGrid = visitRing(col, rw, r, [&](size_t cell)
+        {
+            for (uint32_t i = m_nodeOffsets[cell]; i != m_nodeOffsets[cell + 1]; i++)
+            {
+                NodeId n = m_nodes[i];
+                double dx = projectX(m_graph->longitude(n)) - x;
+                double dy = m_graph->latitude(n) - y;
+                double d2 = dx * dx + dy * dy;
+                if (d2 < bestDist2)
+                {
+                    bestDist2 = d2;
+                    best = n;
+                }
+            }
+        });
+        if (!inGrid)
+            break;
+    }
+
+    return best;
+}
+
+bool SpatialIndex::nearestSegment(double latitude, double longitude, SegmentHit& hit) const
+{
+    if (m_segments.empty())
+        return false;
+
+    double x = projectX(longitude);
+    double y = latitude;
+    int col = column(x);
+    int rw = row(y);
+
+    double bestDist2 = numeric_limits<double>::infinity();
+
+    for (int r = 0; ; r++)
+    {
+        double reach = max(0, r - 1) * m_cellSize;
+        if (bestDist2 <= reach * reach)
+            break;
+
+        bool inGrid = visitRing(col, rw, r, [&](size_t cell)
+        {
+            for (uint32_t i = m_segmentOffsets[cell]; i != m_segmentOffsets[cell + 1]; i++)
+            {
+                const Entry& s = m_segments[i];
+                NodeId to = m_graph->edgeTarget(s.edge);
+                double ax = projectX(m_graph->longitude(s.from)), ay = m_graph->latitude(s.from);
+                double bx = projectX(m_graph->longitude(to)), by = m_graph->latitude(to);
+
+                // Project the query onto the segment, clamped to its ends
+                double vx = bx - ax, vy = by - ay;
+                double len2 = vx * vx + vy * vy;
+                double t = len2 > 0 ? ((x - ax) * vx + (y - ay) * vy) / len2 : 0;
+                t = max(0.0, min(1.0, t));
+
+                double dx = ax + t * vx - x;
+                double dy = ay + t * vy - y;
+                double d2 = dx * dx + dy * dy;
+                if (d2 < bestDist2)
+                {
+                    bestDist2 = d2;
+                    hit.from = s.from;
+                    hit.edge = s.edge;
+                    hit.fraction = t;
+                }
+            }
+        });
+        if (!inGrid)
+            break;
+    }
+
+    NodeId to = m_graph->edgeTarget(hit.edge);
+    hit.latitude = m_graph->latitude(hit.from) + hit.fraction * (m_graph->latitude(to) - m_graph->latitude(hit.from));
+    hit.longitude = m_graph->longitude(hit.from) + hit.fraction * (m_graph->longitude(to) - m_graph->longitude(hit.from));
+    return true;
+}
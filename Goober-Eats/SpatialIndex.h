@@ -0,0 +1,82 @@
+//
+//  SpatialIndex.h
+//  Goober-Eats
+//
+
+#ifndef SpatialIndex_h
+#define SpatialIndex_h
+
+#include "StreetGraph.h"
+#include <vector>
+#include <cstdint>
+
+// A uniform grid over a StreetGraph's nodes and segments, for snapping
+// coordinates that aren't on the map to the nearest node or the nearest
+// point on a street.
+//
+// Coordinates are projected onto a plane (longitude scaled by the cosine of
+// the map's middle latitude), which is accurate to well under a percent
+// across a city. The grid is sized for a couple of segments per cell, and
+// each segment is listed in every cell its bounding box touches. A query
+// scans rings of cells outward from the one it falls in, and stops once
+// the next ring is farther away than the best candidate so far.
+
+class SpatialIndex
+{
+public:
+    typedef StreetGraph::NodeId NodeId;
+    typedef StreetGraph::EdgeId EdgeId;
+
+    // The point on a segment nearest a query
+    struct SegmentHit
+    {
+        NodeId from;        // edge leaves this node
+        EdgeId edge;
+        double fraction;    // 0 at from, 1 at the edge's target
+        double latitude;
+        double longitude;
+    };
+
+    SpatialIndex();
+
+    void build(const StreetGraph& g);
+
+    // NO_NODE if the graph is empty
+    NodeId nearestNode(double latitude, double longitude) const;
+
+    // False if the graph has no segments
+    bool nearestSegment(double latitude, double longitude, SegmentHit& hit) const;
+
+    SpatialIndex(const SpatialIndex&) = delete;
+    SpatialIndex& operator=(const SpatialIndex&) = delete;
+
+private:
+    struct Entry
+    {
+        NodeId from;
+        EdgeId edge;
+    };
+
+    const StreetGraph* m_graph;
+    double m_xScale;                // cos of the middle latitude
+    double m_minX, m_minY;          // projected corner of the grid
+    double m_cellSize;              // in projected degrees
+    int m_cols, m_rows;
+
+    std::vector<uint32_t> m_nodeOffsets;    // CSR by cell, like StreetGraph's edges
+    std::vector<NodeId> m_nodes;
+    std::vector<uint32_t> m_segmentOffsets;
+    std::vector<Entry> m_segments;
+
+    double projectX(double longitude) const { return longitude * m_xScale; }
+    int column(double x) const;
+    int row(double y) const;
+
+    // Calls visit(cell) for each grid cell exactly r cells out from (col,
+    // row). Returns false once the whole ring lies outside the grid, after
+    // which every larger ring does too.
+    template <typename Visit>
+    bool visitRing(int col, int row, int r, Visit visit) const;
+};
+
+#endif /* SpatialIndex_h */
@@ -0,0 +1,447 @@
+#include "StreetGraph.h"
+#include "support.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+
+// POSIX facilities for memory-mapping snapshot files
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+unsigned int hasher(const string& s)
+{
+    return static_cast<unsigned int>(std::hash<string>()(s));
+}
+
+//******************** Snapshot layout ****************************************
+
+// A snapshot file is a fixed header followed by the payload: the graph's
+// arrays one after another, each starting on an 8-byte boundary. Where each
+// array starts is worked out from the counts in the header, so the writer
+// and the reader can never disagree about the layout.
+
+namespace
+{
+    enum Section
+    {
+        LAT, LON, FIXED, COORD_TEXT_OFS, COORD_TEXT, OFFSETS, TARGETS, LENGTHS,
+        BEARINGS, STREETS, STREET_TEXT_OFS, STREET_TEXT, SLOTS, NUM_SECTIONS
+    };
+
+    enum Count
+    {
+        N_NODES, N_EDGES, N_STREETS, N_SLOTS, TEXT_BYTES, NAME_BYTES, NUM_COUNTS
+    };
+
+    const char SNAPSHOT_MAGIC[8] = { 'G', 'O', 'O', 'B', 'M', 'A', 'P', '\0' };
+    const uint32_t SNAPSHOT_VERSION = 3;
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct SnapshotHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t counts[NUM_COUNTS];
+        uint64_t payloadSize;
+        uint64_t checksum;
+    };
+
+    uint64_t align8(uint64_t n)
+    {
+        return (n + 7) & ~uint64_t(7);
+    }
+
+    // Fills in where each section starts and returns the payload size
+    uint64_t layout(const uint64_t* counts, uint64_t* sectionStart)
+    {
+        uint64_t sizes[NUM_SECTIONS];
+        sizes[LAT] = sizeof(double) * counts[N_NODES];
+        sizes[LON] = sizeof(double) * counts[N_NODES];
+        sizes[FIXED] = sizeof(FixedCoord) * counts[N_NODES];
+        sizes[COORD_TEXT_OFS] = sizeof(uint32_t) * (2 * counts[N_NODES] + 1);
+        sizes[COORD_TEXT] = counts[TEXT_BYTES];
+        sizes[OFFSETS] = sizeof(uint32_t) * (counts[N_NODES] + 1);
+        sizes[TARGETS] = sizeof(uint32_t) * counts[N_EDGES];
+        sizes[LENGTHS] = sizeof(double) * counts[N_EDGES];
+        sizes[BEARINGS] = sizeof(double) * counts[N_EDGES];
+        sizes[STREETS] = sizeof(uint32_t) * counts[N_EDGES];
+        sizes[STREET_TEXT_OFS] = sizeof(uint32_t) * (counts[N_STREETS] + 1);
+        sizes[STREET_TEXT] = counts[NAME_BYTES];
+        sizes[SLOTS] = sizeof(uint32_t) * counts[N_SLOTS];
+
+        uint64_t total = 0;
+        for (int i = 0; i < NUM_SECTIONS; i++)
+        {
+            sectionStart[i] = total;
+            total += align8(sizes[i]);
+        }
+        return total;
+    }
+}
+
+//******************** StreetGraph functions **********************************
+
+const StreetGraph::NodeId StreetGraph::NO_NODE;
+
+StreetGraph::StreetGraph()
+: m_nNodes(0), m_nEdges(0), m_nStreets(0), m_nSlots(0),
+  m_lat(nullptr), m_lon(nullptr), m_fixed(nullptr), m_coordText(nullptr), m_text(nullptr),
+  m_offsets(nullptr), m_targets(nullptr), m_lengths(nullptr), m_bearings(nullptr),
+  m_streets(nullptr), m_streetText(nullptr), m_names(nullptr), m_slots(nullptr),
+  m_payload(nullptr), m_payloadSize(0), m_mapping(nullptr), m_mappingSize(0)
+{
+}
+
+StreetGraph::~StreetGraph()
+{
+    if (m_mapping != nullptr)
+        munmap(m_mapping, m_mappingSize);
+}
+
+uint64_t StreetGraph::checksum(const char* data, uint64_t size)
+{
+    // FNV-1a over 64-bit words; payloads are always a multiple of 8 bytes
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint64_t i = 0; i < size; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h ^= w;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+StreetGraph::NodeId StreetGraph::nodeOf(const GeoCoord& gc) const
+{
+    if (m_nSlots == 0)
+        return NO_NODE;
+
+    FixedCoord key(gc);
+    uint32_t mask = m_nSlots - 1;
+
+    for (uint32_t i = hasher(key) & mask; ; i = (i + 1) & mask)
+    {
+        NodeId n = m_slots[i];
+        if (n == NO_NODE || m_fixed[n] == key)
+            return n;
+    }
+}
+
+GeoCoord StreetGraph::coord(NodeId n) const
+{
+    const char* text = m_text + m_coordText[2*n];
+    string lat(text, m_coordText[2*n+1] - m_coordText[2*n]);
+    string lon(text + lat.size(), m_coordText[2*n+2] - m_coordText[2*n+1]);
+    return GeoCoord(lat, lon);
+}
+
+string StreetGraph::streetName(uint32_t street) const
+{
+    return string(m_names + m_streetText[street], m_streetText[street+1] - m_streetText[street]);
+}
+
+StreetGraph::EdgeId StreetGraph::reverseEdge(NodeId from, EdgeId e) const
+{
+    // Every segment was added in both directions, so the twin is there
+    NodeId to = m_targets[e];
+    EdgeId twin = firstEdge(to);
+    for (EdgeId r = firstEdge(to); r != endEdge(to); r++)
+    {
+        if (m_targets[r] == from && m_streets[r] == m_streets[e])
+        {
+            twin = r;
+            break;
+        }
+    }
+    return twin;
+}
+
+StreetSegment StreetGraph::edgeSegment(NodeId from, EdgeId e) const
+{
+    return StreetSegment(coord(from), coord(m_targets[e]), edgeStreetName(e));
+}
+
+StreetSegmentRange StreetGraph::segmentsFrom(NodeId n) const
+{
+    call_once(m_segmentsBuilt, [this]() { buildSegments(); });
+
+    const StreetSegment* base = m_segments.data();
+    return StreetSegmentRange(base + firstEdge(n), base + endEdge(n));
+}
+
+void StreetGraph::buildSegments() const
+{
+    m_segments.reserve(m_nEdges);
+    for (NodeId n = 0; n < m_nNodes; n++)
+    {
+        for (EdgeId e = firstEdge(n); e != endEdge(n); e++)
+            m_segments.push_back(edgeSegment(n, e));
+    }
+}
+
+bool StreetGraph::bindSections(const char* payload, const uint64_t* counts)
+{
+    uint64_t start[NUM_SECTIONS];
+    m_payloadSize = layout(counts, start);
+    m_payload = payload;
+
+    m_nNodes = static_cast<uint32_t>(counts[N_NODES]);
+    m_nEdges = static_cast<uint32_t>(counts[N_EDGES]);
+    m_nStreets = static_cast<uint32_t>(counts[N_STREETS]);
+    m_nSlots = static_cast<uint32_t>(counts[N_SLOTS]);
+
+    m_lat = reinterpret_cast<const double*>(payload + start[LAT]);
+    m_lon = reinterpret_cast<const double*>(payload + start[LON]);
+    m_fixed = reinterpret_cast<const FixedCoord*>(payload + start[FIXED]);
+    m_coordText = reinterpret_cast<const uint32_t*>(payload + start[COORD_TEXT_OFS]);
+    m_text = payload + start[COORD_TEXT];
+    m_offsets = reinterpret_cast<const EdgeId*>(payload + start[OFFSETS]);
+    m_targets = reinterpret_cast<const NodeId*>(payload + start[TARGETS]);
+    m_lengths = reinterpret_cast<const double*>(payload + start[LENGTHS]);
+    m_bearings = reinterpret_cast<const double*>(payload + start[BEARINGS]);
+    m_streets = reinterpret_cast<const uint32_t*>(payload + start[STREETS]);
+    m_streetText = reinterpret_cast<const uint32_t*>(payload + start[STREET_TEXT_OFS]);
+    m_names = payload + start[STREET_TEXT];
+    m_slots = reinterpret_cast<const NodeId*>(payload + start[SLOTS]);
+
+    // Cheap consistency checks on the array boundaries
+    return m_offsets[m_nNodes] == m_nEdges &&
+           m_coordText[2*m_nNodes] == counts[TEXT_BYTES] &&
+           m_streetText[m_nStreets] == counts[NAME_BYTES] &&
+           (m_nSlots & (m_nSlots - 1)) == 0 && m_nSlots > m_nNodes;
+}
+
+bool StreetGraph::saveSnapshot(const string& snapshotFile) const
+{
+    if (m_payload == nullptr)
+    {
+        cerr << "No map loaded; nothing to write to " << snapshotFile << endl;
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.counts[N_NODES] = m_nNodes;
+    header.counts[N_EDGES] = m_nEdges;
+    header.counts[N_STREETS] = m_nStreets;
+    header.counts[N_SLOTS] = m_nSlots;
+    header.counts[TEXT_BYTES] = m_coordText[2*m_nNodes];
+    header.counts[NAME_BYTES] = m_streetText[m_nStreets];
+    header.payloadSize = m_payloadSize;
+    header.checksum = checksum(m_payload, m_payloadSize);
+
+    ofstream outfile(snapshotFile, ios::binary | ios::trunc);
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(m_payload, m_payloadSize);
+    if (!outfile)
+    {
+        cerr << "Cannot write " << snapshotFile << "!" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool StreetGraph::mapSnapshot(const string& snapshotFile)
+{
+    int fd = open(snapshotFile.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "Cannot open " << snapshotFile << "!" << endl;
+        return false;
+    }
+
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(SnapshotHeader)))
+        mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping keeps the file alive
+
+    if (mapping == MAP_FAILED)
+    {
+        cerr << "Cannot map " << snapshotFile << "!" << endl;
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(mapping);
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+
+    uint64_t start[NUM_SECTIONS];
+    const char* problem = nullptr;
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+        problem = "not a map snapshot";
+    else if (header.version != SNAPSHOT_VERSION)
+        problem = "unsupported snapshot version";
+    else if (header.byteOrder != BYTE_ORDER_MARK)
+        problem = "snapshot was written on a machine with a different byte order";
+    else if (layout(header.counts, start) != header.payloadSize ||
+             sizeof(header) + header.payloadSize != static_cast<uint64_t>(st.st_size))
+        problem = "snapshot is truncated or has inconsistent sizes";
+    else if (checksum(base + sizeof(header), header.payloadSize) != header.checksum)
+        problem = "snapshot checksum mismatch";
+    else if (!bindSections(base + sizeof(header), header.counts))
+        problem = "snapshot arrays are inconsistent";
+
+    if (problem != nullptr)
+    {
+        cerr << snapshotFile << ": " << problem << "!" << endl;
+        munmap(mapping, st.st_size);
+        m_nNodes = m_nEdges = m_nStreets = m_nSlots = 0;
+        m_payload = nullptr;
+        return false;
+    }
+
+    m_mapping = mapping;
+    m_mappingSize = st.st_size;
+    return true;
+}
+
+bool StreetGraph::isSnapshotFile(const string& path)
+{
+    ifstream infile(path, ios::binary);
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    if (!infile.read(magic, sizeof(magic)))
+        return false;
+    return memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+}
+
+//******************** StreetGraphBuilder functions ***************************
+
+void StreetGraphBuilder::reserve(size_t nSegments)
+{
+    // Most coordinates are shared by two segments, so this rarely grows
+    m_ids.reserve(static_cast<int>(nSegments + 1));
+    m_coords.reserve(nSegments + 1);
+    m_edges.reserve(2 * nSegments);
+}
+
+StreetGraph::NodeId StreetGraphBuilder::addNode(const GeoCoord& gc)
+{
+    StreetGraph::NodeId newId = static_cast<StreetGraph::NodeId>(m_coords.size());
+    StreetGraph::NodeId id = *m_ids.emplace(FixedCoord(gc), newId);
+    if (id == newId)
+        m_coords.push_back(gc);
+    return id;
+}
+
+uint32_t StreetGraphBuilder::addStreet(const string& name)
+{
+    // Long streets are often split across several blocks of the map file
+    uint32_t newId = static_cast<uint32_t>(m_streets.size());
+    uint32_t id = *m_streetIds.emplace(name, newId);
+    if (id == newId)
+        m_streets.push_back(name);
+    return id;
+}
+
+void StreetGraphBuilder::addSegment(StreetGraph::NodeId from, StreetGraph::NodeId to, uint32_t street)
+{
+    m_edges.push_back(RawEdge{from, to, street});
+    m_edges.push_back(RawEdge{to, from, street});
+}
+
+void StreetGraphBuilder::build(StreetGraph& g)
+{
+    uint64_t counts[NUM_COUNTS];
+    counts[N_NODES] = m_coords.size();
+    counts[N_EDGES] = m_edges.size();
+    counts[N_STREETS] = m_streets.size();
+
+    // Keep the lookup table at most half full
+    counts[N_SLOTS] = 8;
+    while (counts[N_SLOTS] < 2 * counts[N_NODES])
+        counts[N_SLOTS] *= 2;
+
+    counts[TEXT_BYTES] = 0;
+    for (const GeoCoord& gc : m_coords)
+        counts[TEXT_BYTES] += gc.latitudeText.size() + gc.longitudeText.size();
+    counts[NAME_BYTES] = 0;
+    for (const string& name : m_streets)
+        counts[NAME_BYTES] += name.size();
+
+    uint64_t start[NUM_SECTIONS];
+    uint64_t payloadSize = layout(counts, start);
+    g.m_buffer.assign(payloadSize / 8, 0);
+    char* payload = reinterpret_cast<char*>(g.m_buffer.data());
+
+    double* lat = reinterpret_cast<double*>(payload + start[LAT]);
+    double* lon = reinterpret_cast<double*>(payload + start[LON]);
+    FixedCoord* fixed = reinterpret_cast<FixedCoord*>(payload + start[FIXED]);
+    uint32_t* coordText = reinterpret_cast<uint32_t*>(payload + start[COORD_TEXT_OFS]);
+    char* text = payload + start[COORD_TEXT];
+    StreetGraph::EdgeId* offsets = reinterpret_cast<StreetGraph::EdgeId*>(payload + start[OFFSETS]);
+    StreetGraph::NodeId* targets = reinterpret_cast<StreetGraph::NodeId*>(payload + start[TARGETS]);
+    double* lengths = reinterpret_cast<double*>(payload + start[LENGTHS]);
+    double* bearings = reinterpret_cast<double*>(payload + start[BEARINGS]);
+    uint32_t* streets = reinterpret_cast<uint32_t*>(payload + start[STREETS]);
+    uint32_t* streetText = reinterpret_cast<uint32_t*>(payload + start[STREET_TEXT_OFS]);
+    char* names = payload + start[STREET_TEXT];
+    StreetGraph::NodeId* slots = reinterpret_cast<StreetGraph::NodeId*>(payload + start[SLOTS]);
+
+    // Coordinates, their text, and the lookup table
+    uint32_t nNodes = static_cast<uint32_t>(m_coords.size());
+    uint32_t mask = static_cast<uint32_t>(counts[N_SLOTS]) - 1;
+    uint32_t pos = 0;
+    fill(slots, slots + counts[N_SLOTS], StreetGraph::NO_NODE);
+    for (uint32_t n = 0; n < nNodes; n++)
+    {
+        const GeoCoord& gc = m_coords[n];
+        lat[n] = gc.latitude;
+        lon[n] = gc.longitude;
+        fixed[n] = FixedCoord(gc);
+
+        coordText[2*n] = pos;
+        memcpy(text + pos, gc.latitudeText.data(), gc.latitudeText.size());
+        pos += gc.latitudeText.size();
+        coordText[2*n+1] = pos;
+        memcpy(text + pos, gc.longitudeText.data(), gc.longitudeText.size());
+        pos += gc.longitudeText.size();
+
+        uint32_t i = hasher(fixed[n]) & mask;
+        while (slots[i] != StreetGraph::NO_NODE)
+            i = (i + 1) & mask;
+        slots[i] = n;
+    }
+    coordText[2*nNodes] = pos;
+
+    // Street names
+    pos = 0;
+    for (size_t s = 0; s < m_streets.size(); s++)
+    {
+        streetText[s] = pos;
+        memcpy(names + pos, m_streets[s].data(), m_streets[s].size());
+        pos += m_streets[s].size();
+    }
+    streetText[m_streets.size()] = pos;
+
+    // Count the edges leaving each node, then turn the counts into offsets
+    for (const RawEdge& r : m_edges)
+        offsets[r.from + 1]++;
+    for (uint32_t n = 0; n < nNodes; n++)
+        offsets[n + 1] += offsets[n];
+
+    // Drop each edge into its node's slot range. Edges keep the order they
+    // were read in, so segments come back in file order for each node.
+    vector<StreetGraph::EdgeId> next(offsets, offsets + nNodes);
+    for (const RawEdge& r : m_edges)
+    {
+        StreetGraph::EdgeId e = next[r.from]++;
+        targets[e] = r.to;
+        lengths[e] = distanceEarthMiles(m_coords[r.from], m_coords[r.to]);
+        bearings[e] = angleOfLine(m_coords[r.from].latitude, m_coords[r.from].longitude,
+                                  m_coords[r.to].latitude, m_coords[r.to].longitude);
+        streets[e] = r.street;
+    }
+
+    g.bindSections(payload, counts);
+}
@@ -0,0 +1,177 @@
+//
+//  StreetGraph.h
+//  Goober-Eats
+//
+
+#ifndef StreetGraph_h
+#define StreetGraph_h
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include "FixedCoord.h"
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// The street network in compact form, built by StreetMap::load.
+//
+// Every distinct coordinate in the map file (to 1e-7 degrees; see
+// FixedCoord.h) is interned into a dense node ID (0 .. nodeCount()-1).
+// Outgoing edges are kept in compressed sparse row layout: the edges
+// leaving node n are firstEdge(n) .. endEdge(n)-1, and each edge has a
+// target node, a length in miles, and the street it lies on. Street names
+// are interned once each into a name table, and edges refer to them by a
+// dense 32-bit street ID (0 .. streetCount()-1), so two edges are on the
+// same street exactly when their IDs match.
+// Each segment in the file appears twice, once per direction.
+//
+// All of this lives in a handful of flat arrays that are laid out exactly
+// as in a map snapshot file (see saveSnapshot), so a graph can either own
+// its arrays or use a memory-mapped snapshot in place.
+
+class StreetGraph
+{
+public:
+    typedef uint32_t NodeId;
+    typedef uint32_t EdgeId;
+
+    static const NodeId NO_NODE = 0xFFFFFFFF;
+
+    StreetGraph();
+    ~StreetGraph();
+
+    int nodeCount() const { return static_cast<int>(m_nNodes); }
+    int edgeCount() const { return static_cast<int>(m_nEdges); }
+    int streetCount() const { return static_cast<int>(m_nStreets); }
+
+    // Returns NO_NODE if gc is not the endpoint of any segment
+    NodeId nodeOf(const GeoCoord& gc) const;
+
+    GeoCoord coord(NodeId n) const;
+    double latitude(NodeId n) const { return m_lat[n]; }
+    double longitude(NodeId n) const { return m_lon[n]; }
+    FixedCoord fixedCoord(NodeId n) const { return m_fixed[n]; }
+
+    EdgeId firstEdge(NodeId n) const { return m_offsets[n]; }
+    EdgeId endEdge(NodeId n) const { return m_offsets[n+1]; }
+
+    NodeId edgeTarget(EdgeId e) const { return m_targets[e]; }
+    double edgeLength(EdgeId e) const { return m_lengths[e]; }
+    // Degrees counterclockwise from east, as angleOfLine gives for the
+    // edge's segment
+    double edgeBearing(EdgeId e) const { return m_bearings[e]; }
+    uint32_t edgeStreet(EdgeId e) const { return m_streets[e]; }
+    std::string edgeStreetName(EdgeId e) const { return streetName(m_streets[e]); }
+
+    std::string streetName(uint32_t street) const;
+
+    // The edge running the other way along the same segment as edge e,
+    // which must leave node from
+    EdgeId reverseEdge(NodeId from, EdgeId e) const;
+
+    // The StreetSegment for edge e, which must leave node from
+    StreetSegment edgeSegment(NodeId from, EdgeId e) const;
+
+    // The segments of all edges leaving n, in file order. The first call
+    // builds StreetSegment objects for the whole map; later calls are free.
+    StreetSegmentRange segmentsFrom(NodeId n) const;
+
+    // Write this graph as a binary snapshot that mapSnapshot can use in place
+    bool saveSnapshot(const std::string& snapshotFile) const;
+
+    // Map a snapshot file into memory and use it as this graph's storage.
+    // The pages are shared with any other process mapping the same file.
+    bool mapSnapshot(const std::string& snapshotFile);
+
+    // Size of the mapped snapshot file, or 0 if this graph owns its arrays
+    size_t snapshotBytes() const { return m_mappingSize; }
+
+    // True if the file starts with the snapshot magic number
+    static bool isSnapshotFile(const std::string& path);
+
+    // Identifies the map this graph was built from: the checksum of its
+    // arrays, which is the same whether it was parsed or mapped
+    uint64_t fingerprint() const { return checksum(m_payload, m_payloadSize); }
+
+    // FNV-1a over 64-bit words, used for snapshot checksums; size must be a
+    // multiple of 8
+    static uint64_t checksum(const char* data, uint64_t size);
+
+    StreetGraph(const StreetGraph&) = delete;
+    StreetGraph& operator=(const StreetGraph&) = delete;
+
+private:
+    friend class StreetGraphBuilder;
+
+    uint32_t m_nNodes;
+    uint32_t m_nEdges;
+    uint32_t m_nStreets;
+    uint32_t m_nSlots;      // size of the node lookup table, a power of 2
+
+    const double* m_lat;            // indexed by NodeId
+    const double* m_lon;
+    const FixedCoord* m_fixed;
+    const uint32_t* m_coordText;    // node n's text is [2n, 2n+1, 2n+2) in m_text
+    const char* m_text;
+    const EdgeId* m_offsets;        // nodeCount()+1 entries
+    const NodeId* m_targets;        // indexed by EdgeId
+    const double* m_lengths;        // distanceEarthMiles of each edge
+    const double* m_bearings;
+    const uint32_t* m_streets;
+    const uint32_t* m_streetText;   // street s's name is [s, s+1) in m_names
+    const char* m_names;
+    const NodeId* m_slots;          // open-addressing table of NodeIds, keyed by m_fixed
+
+    // Backing storage: a buffer we own, or a mapped snapshot file
+    const char* m_payload;
+    uint64_t m_payloadSize;
+    std::vector<uint64_t> m_buffer;
+    void* m_mapping;
+    size_t m_mappingSize;
+
+    mutable std::vector<StreetSegment> m_segments;
+    mutable std::once_flag m_segmentsBuilt;
+
+    bool bindSections(const char* payload, const uint64_t* counts);
+    void buildSegments() const;
+};
+
+// Collects coordinates and segments while a map file is being read, then
+// packs them into a StreetGraph.
+class StreetGraphBuilder
+{
+public:
+    // Make room for about this many segments up front
+    void reserve(size_t nSegments);
+
+    // Returns the node ID for gc, assigning the next free one if it is new
+    StreetGraph::NodeId addNode(const GeoCoord& gc);
+
+    // Returns the ID for a street name, assigning the next free one if it
+    // is new; segments on the street refer to it by that ID
+    uint32_t addStreet(const std::string& name);
+
+    // Adds edges from -> to and to -> from
+    void addSegment(StreetGraph::NodeId from, StreetGraph::NodeId to, uint32_t street);
+
+    // Lays everything out in g, which must be freshly constructed
+    void build(StreetGraph& g);
+
+private:
+    struct RawEdge
+    {
+        StreetGraph::NodeId from;
+        StreetGraph::NodeId to;
+        uint32_t street;
+    };
+
+    ExpandableHashMap<FixedCoord, StreetGraph::NodeId> m_ids;
+    std::vector<GeoCoord> m_coords;
+    ExpandableHashMap<std::string, uint32_t> m_streetIds;
+    std::vector<std::string> m_streets;
+    std::vector<RawEdge> m_edges;
+};
+
+#endif /* StreetGraph_h */
@@ -4,16 +4,24 @@
 #include <functional>
 
 #include "ExpandableHashMap.h"
+#include "StreetGraph.h"
+#include "ContractionHierarchy.h"
+#include "Landmarks.h"
+#include "SpatialIndex.h"
+#include "FixedCoord.h"
+
+#include "MapTextParser.h"
 
-// C++ Facilities for File I/O
 #include <iostream>
 #include <fstream>
+#include <chrono>
 
 using namespace std;
 
 unsigned int hasher(const GeoCoord& g)
 {
-    return hash<string>()(g.latitudeText + g.longitudeText);
+    // Hash the fixed-point form rather than building a string from the text
+    return hasher(FixedCoord(g));
 }
 
 class StreetMapImpl
@@ -23,110 +31,208 @@ public:
     ~StreetMapImpl();
     bool load(string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    bool getSegmentsThatStartWith(const GeoCoord& gc, StreetSegmentRange& segs) const;
+    bool saveSnapshot(string snapshotFile) const;
+    const StreetGraph* graph() const { return m_graph; }
+    const MapLoadStats& loadStats() const { return m_loadStats; }
+    void buildHierarchy();
+    bool saveHierarchy(string hierarchyFile) const;
+    bool loadHierarchy(string hierarchyFile);
+    const ContractionHierarchy* hierarchy() const { return m_hierarchy; }
+    void buildLandmarks(int count);
+    bool saveLandmarks(string landmarkFile) const;
+    bool loadLandmarks(string landmarkFile);
+    const Landmarks* landmarks() const { return m_landmarks; }
+    bool nearestCoord(const GeoCoord& gc, GeoCoord& nearest) const;
+    bool nearestPointOnStreet(const GeoCoord& gc, StreetSegment& seg, GeoCoord& point) const;
     
 private:
-    ExpandableHashMap<GeoCoord, vector<StreetSegment>> map;
+    StreetGraph* m_graph;
+    ContractionHierarchy* m_hierarchy;  // nullptr until built or loaded
+    Landmarks* m_landmarks;             // likewise
+    SpatialIndex m_index;               // over m_graph
+    MapLoadStats m_loadStats;
+    
+    bool loadText(string mapFile, StreetGraph& g, MapLoadStats& stats);
 };
 
 StreetMapImpl::StreetMapImpl()
+: m_hierarchy(nullptr), m_landmarks(nullptr)
 {
-    load("/Users/danlee/Documents/CS32/Goober-Eats/Goober-Eats/mapdata.txt");
+    m_graph = new StreetGraph;
 }
 
 StreetMapImpl::~StreetMapImpl()
 {
+    delete m_landmarks;
+    delete m_hierarchy;
+    delete m_graph;
 }
 
 bool StreetMapImpl::load(string mapFile)
 {
-    ifstream infile(mapFile);
+    auto startTime = chrono::steady_clock::now();
     
-    if (!infile)
+    // Build the new graph on the side so a failed load leaves the old one
+    StreetGraph* g = new StreetGraph;
+    MapLoadStats stats;
+    bool loaded;
+    
+    if (StreetGraph::isSnapshotFile(mapFile))
     {
-        cerr << "Cannot open " << mapFile << "!";
+        loaded = g->mapSnapshot(mapFile);
+        stats.bytes = g->snapshotBytes();
+    }
+    else
+        loaded = loadText(mapFile, *g, stats);
+    
+    if (!loaded)
+    {
+        delete g;
         return false;
     }
     
-    // Begin loading map data.
-    string streetName = "";
-    int nSegments = 0;
-    string startLatText, startLongText, endLatText, endLongText;
+    delete m_hierarchy;
+    m_hierarchy = nullptr;
+    delete m_landmarks;
+    m_landmarks = nullptr;
+    delete m_graph;
+    m_graph = g;
+    m_index.build(*m_graph);
+    
+    // Files for another version of the map are reported and ignored
+    if (ifstream(mapFile + ".ch"))
+        loadHierarchy(mapFile + ".ch");
+    if (ifstream(mapFile + ".alt"))
+        loadLandmarks(mapFile + ".alt");
     
-    // loop this after you implement
-    // Read in street name and store in streetName.
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    m_loadStats = stats;
+    return true;
+}
+
+bool StreetMapImpl::loadText(string mapFile, StreetGraph& g, MapLoadStats& stats)
+{
+    StreetGraphBuilder builder;
+    if (!parseMapText(mapFile, builder, stats))
+        return false;
     
-    while( true )
+    builder.build(g);
+    return true;
+}
+
+void StreetMapImpl::buildHierarchy()
+{
+    ContractionHierarchy* ch = new ContractionHierarchy;
+    ch->build(*m_graph);
+    delete m_hierarchy;
+    m_hierarchy = ch;
+}
+
+bool StreetMapImpl::saveHierarchy(string hierarchyFile) const
+{
+    if (m_hierarchy == nullptr)
     {
-        //Read in street name.
-        getline(infile, streetName);
-        if (!infile) // Reached end of file trying to take street name
-            break;
-        
-        // Read in number of street segments for this street.
-        infile >> nSegments;
-        infile.ignore(10000, '\n');
-        
-        for (int i = 0; i < nSegments; i++)
-        {
-            // Extract start GeoCoord.
-            infile >> startLatText;
-            infile >> startLongText;
-            GeoCoord s(startLatText, startLongText);
-            
-            // Extract end GeoCoord.
-            infile >> endLatText;
-            infile >> endLongText;
-            GeoCoord e(endLatText, endLongText);
-            infile.ignore(10000, '\n');
-            
-            // Create two StreetSegments
-            StreetSegment seg(s, e, streetName);
-            StreetSegment rev(e, s, streetName);
-            
-            // Get pointers to our StreetSegment vectors within map so that
-            // we may push_back our StreetSegments into said vectors
-            vector<StreetSegment>* segVec = map.find(s);
-            
-            
-            // Create an association if respective vector does not yet exist,
-            // Otherwise, push_back the StreetSegment to the existing vector
-            if (segVec != nullptr)
-                segVec->push_back(seg);
-            else
-            {
-                vector<StreetSegment> addSeg;
-                addSeg.push_back(seg);
-                map.associate(s, addSeg);
-            }
-            
-            vector<StreetSegment>* revVec = map.find(e);
-            if (revVec != nullptr)
-                revVec->push_back(rev);
-            else
-            {
-                vector<StreetSegment> addRev;
-                addRev.push_back(rev);
-                map.associate(e, addRev);
-            }
-            
-        }
+        cerr << "No hierarchy built; nothing to write to " << hierarchyFile << endl;
+        return false;
     }
+    return m_hierarchy->save(hierarchyFile);
+}
+
+bool StreetMapImpl::loadHierarchy(string hierarchyFile)
+{
+    ContractionHierarchy* ch = new ContractionHierarchy;
+    if (!ch->load(hierarchyFile, *m_graph))
+    {
+        delete ch;
+        return false;
+    }
+    delete m_hierarchy;
+    m_hierarchy = ch;
+    return true;
+}
+
+bool StreetMapImpl::nearestCoord(const GeoCoord& gc, GeoCoord& nearest) const
+{
+    StreetGraph::NodeId n = m_index.nearestNode(gc.latitude, gc.longitude);
+    if (n == StreetGraph::NO_NODE)
+        return false;
     
-    return true;  
+    nearest = m_graph->coord(n);
+    return true;
+}
+
+bool StreetMapImpl::nearestPointOnStreet(const GeoCoord& gc, StreetSegment& seg, GeoCoord& point) const
+{
+    SpatialIndex::SegmentHit hit;
+    if (!m_index.nearestSegment(gc.latitude, gc.longitude, hit))
+        return false;
+    
+    seg = m_graph->edgeSegment(hit.from, hit.edge);
+    point = FixedCoord(static_cast<int32_t>(llround(hit.latitude * FixedCoord::SCALE)),
+                       static_cast<int32_t>(llround(hit.longitude * FixedCoord::SCALE))).toGeoCoord();
+    return true;
+}
+
+void StreetMapImpl::buildLandmarks(int count)
+{
+    Landmarks* lm = new Landmarks;
+    lm->build(*m_graph, count);
+    delete m_landmarks;
+    m_landmarks = lm;
+}
+
+bool StreetMapImpl::saveLandmarks(string landmarkFile) const
+{
+    if (m_landmarks == nullptr)
+    {
+        cerr << "No landmarks built; nothing to write to " << landmarkFile << endl;
+        return false;
+    }
+    return m_landmarks->save(landmarkFile);
+}
+
+bool StreetMapImpl::loadLandmarks(string landmarkFile)
+{
+    Landmarks* lm = new Landmarks;
+    if (!lm->load(landmarkFile, *m_graph))
+    {
+        delete lm;
+        return false;
+    }
+    delete m_landmarks;
+    m_landmarks = lm;
+    return true;
 }
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-    const vector<StreetSegment>* segVec = map.find(gc);
-    if (!segVec)
+    StreetGraph::NodeId n = m_graph->nodeOf(gc);
+    if (n == StreetGraph::NO_NODE)
         return false;
     
-    // Copy the vector to which gc maps to segs.
-    segs = *segVec;
+    // Copy the segments leaving gc to segs.
+    StreetSegmentRange range = m_graph->segmentsFrom(n);
+    segs.assign(range.begin(), range.end());
+    
+    return true;
+}
+
+bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, StreetSegmentRange& segs) const
+{
+    StreetGraph::NodeId n = m_graph->nodeOf(gc);
+    if (n == StreetGraph::NO_NODE)
+        return false;
     
+    segs = m_graph->segmentsFrom(n);
     return true;
 }
 
+bool StreetMapImpl::saveSnapshot(string snapshotFile) const
+{
+    return m_graph->saveSnapshot(snapshotFile);
+}
+
 
 //******************** StreetMap functions ************************************
 
@@ -152,3 +258,73 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
 {
    return m_impl->getSegmentsThatStartWith(gc, segs);
 }
+
+bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, StreetSegmentRange& segs) const
+{
+   return m_impl->getSegmentsThatStartWith(gc, segs);
+}
+
+bool StreetMap::saveSnapshot(string snapshotFile) const
+{
+    return m_impl->saveSnapshot(snapshotFile);
+}
+
+const MapLoadStats& StreetMap::loadStats() const
+{
+    return m_impl->loadStats();
+}
+
+const StreetGraph* StreetMap::graph() const
+{
+    return m_impl->graph();
+}
+
+void StreetMap::buildHierarchy()
+{
+    m_impl->buildHierarchy();
+}
+
+bool StreetMap::saveHierarchy(string hierarchyFile) const
+{
+    return m_impl->saveHierarchy(hierarchyFile);
+}
+
+bool StreetMap::loadHierarchy(string hierarchyFile)
+{
+    return m_impl->loadHierarchy(hierarchyFile);
+}
+
+const ContractionHierarchy* StreetMap::hierarchy() const
+{
+    return m_impl->hierarchy();
+}
+
+void StreetMap::buildLandmarks(int count)
+{
+    m_impl->buildLandmarks(count);
+}
+
+bool StreetMap::saveLandmarks(string landmarkFile) const
+{
+    return m_impl->saveLandmarks(landmarkFile);
+}
+
+bool StreetMap::loadLandmarks(string landmarkFile)
+{
+    return m_impl->loadLandmarks(landmarkFile);
+}
+
+const Landmarks* StreetMap::landmarks() const
+{
+    return m_impl->landmarks();
+}
+
+bool StreetMap::nearestCoord(const GeoCoord& gc, GeoCoord& nearest) const
+{
+    return m_impl->nearestCoord(gc, nearest);
+}
+
+bool StreetMap::nearestPointOnStreet(const GeoCoord& gc, StreetSegment& seg, GeoCoord& point) const
+{
+    return m_impl->nearestPointOnStreet(gc, seg, point);
+}
@@ -0,0 +1,113 @@
+#include "ThreadPool.h"
+#include <atomic>
+
+using namespace std;
+
+// One call to run. Tasks are handed out by bumping next; whoever takes the
+// last one wakes the caller.
+struct ThreadPool::Job
+{
+    const function<void(int, int)>* task;
+    int n;
+    atomic<int> next;
+    atomic<int> nextSlot;
+    atomic<int> remaining;
+
+    mutex doneMutex;
+    condition_variable done;
+};
+
+ThreadPool::ThreadPool(int nThreads)
+: m_stopping(false)
+{
+    if (nThreads <= 0)
+        nThreads = static_cast<int>(thread::hardware_concurrency());
+
+    // The thread that calls run is one of the nThreads
+    for (int i = 1; i < nThreads; i++)
+        m_workers.push_back(thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (thread& t : m_workers)
+        t.join();
+}
+
+void ThreadPool::run(int n, const function<void(int, int)>& task)
+{
+    if (n <= 0)
+        return;
+
+    shared_ptr<Job> job = make_shared<Job>();
+    job->task = &task;
+    job->n = n;
+    job->next = 0;
+    job->nextSlot = 1;  // slot 0 is ours
+    job->remaining = n;
+
+    if (!m_workers.empty() && n > 1)
+    {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_jobs.push_back(job);
+        }
+        m_wake.notify_all();
+    }
+
+    work(*job, 0);
+
+    // Others may still be finishing tasks they took
+    unique_lock<mutex> lock(job->doneMutex);
+    job->done.wait(lock, [&job]() { return job->remaining == 0; });
+}
+
+void ThreadPool::work(Job& job, int slot)
+{
+    for (int i = job.next++; i < job.n; i = job.next++)
+    {
+        (*job.task)(i, slot);
+
+        if (--job.remaining == 0)
+        {
+            lock_guard<mutex> lock(job.doneMutex);
+            job.done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    for (;;)
+    {
+        shared_ptr<Job> job;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping)
+                return;
+
+            // Jobs with no tasks left to hand out are done with the queue
+            job = m_jobs.front();
+            if (job->next >= job->n)
+            {
+                m_jobs.pop_front();
+                continue;
+            }
+        }
+
+        work(*job, job->nextSlot++);
+    }
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,59 @@
+//
+//  ThreadPool.h
+//  Goober-Eats
+//
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// A fixed set of worker threads for fanning a batch of independent tasks
+// out across cores.
+//
+// run(n, task) calls task(i, slot) for every i in [0, n). The calling
+// thread works through tasks alongside the pool's threads, so run can be
+// called from inside a task (or on a pool with no threads at all) without
+// deadlocking. slot is in [0, size()) and no two tasks of the same run
+// that execute at the same time share a slot, so it can index per-thread
+// scratch space that callers keep between runs.
+
+class ThreadPool
+{
+public:
+      // nThreads counts the calling thread; 0 means one per core
+    explicit ThreadPool(int nThreads = 0);
+    ~ThreadPool();
+
+      // The most tasks of one run that can execute at once
+    int size() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    void run(int n, const std::function<void(int task, int slot)>& task);
+
+      // A pool with one thread per core, shared by anything that isn't
+      // handed a pool of its own
+    static ThreadPool& shared();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    struct Job;
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::shared_ptr<Job>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping;
+
+    void workerLoop();
+    static void work(Job& job, int slot);
+};
+
+#endif /* ThreadPool_h */
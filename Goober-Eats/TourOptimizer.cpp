@@ -0,0 +1,512 @@
+#include "TourOptimizer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <atomic>
+
+using namespace std;
+
+constexpr double TourOptimizer::UNREACHABLE_COST;
+constexpr double TourOptimizer::MIN_GAIN;
+const int TourOptimizer::MAX_EXACT_STOPS;
+
+namespace
+{
+    // Or-opt moves runs of at most this many stops
+    const int MAX_OR_OPT_RUN = 3;
+
+    // Annealing starts out accepting a move that lengthens the tour by
+    // START_TEMPERATURE times an average leg about a third of the time,
+    // and cools geometrically until such a move is all but never taken
+    const double START_TEMPERATURE = 0.5;
+    const double END_TEMPERATURE = 0.01;
+
+    // Annealing moves join each stop to one of this many nearest stops
+    const int NEIGHBOURS = 8;
+
+    // How many annealing moves, or subsets filled in by the exact solver,
+    // go by between looks at the clock
+    const int CLOCK_CHECK_INTERVAL = 256;
+
+    // A layer of the Held-Karp table is only split across threads if it
+    // takes at least this many steps (masks times stops squared)
+    const long PARALLEL_LAYER_WORK = 1 << 18;
+
+    // A pessimistic rate for the Held-Karp inner loop, table allocation
+    // included; one core of a laptop does about half as much again
+    const double EXACT_STEPS_PER_SECOND = 2e8;
+}
+
+TourOptimizer::TourOptimizer(const vector<double>& cost, int n)
+: m_cost(cost), m_n(n)
+{
+}
+
+vector<int> TourOptimizer::nearestNeighbourOrder() const
+{
+    vector<int> order;
+    vector<bool> visited(m_n, false);
+    int current = 0;
+
+    for (int k = 1; k < m_n; k++)
+    {
+        int nearest = -1;
+        for (int s = 1; s < m_n; s++)
+        {
+            if (!visited[s] && (nearest == -1 || cost(current, s) < cost(current, nearest)))
+                nearest = s;
+        }
+        visited[nearest] = true;
+        order.push_back(nearest);
+        current = nearest;
+    }
+
+    return order;
+}
+
+double TourOptimizer::tourCost(const vector<int>& order) const
+{
+    double total = 0;
+    int prev = 0;
+    for (int s : order)
+    {
+        total += cost(prev, s);
+        prev = s;
+    }
+    return total + cost(prev, 0);
+}
+
+double TourOptimizer::optimize(vector<int>& order, const OptimizerOptions& options,
+                               const function<int(int, int)>& random) const
+{
+    auto deadline = chrono::steady_clock::now() +
+        chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.maxSeconds));
+    int rounds;
+    return improve(order, options, random, deadline, 1, rounds);
+}
+
+double TourOptimizer::optimizeUntil(vector<int>& order, const OptimizerOptions& options,
+                                    chrono::steady_clock::time_point deadline,
+                                    const function<int(int, int)>& random, int& rounds) const
+{
+    return improve(order, options, random, deadline, numeric_limits<int>::max(), rounds);
+}
+
+double TourOptimizer::improve(vector<int>& order, const OptimizerOptions& options,
+                              const function<int(int, int)>& random,
+                              chrono::steady_clock::time_point deadline,
+                              int maxAnnealRounds, int& rounds) const
+{
+    vector<int> tour;
+    tour.push_back(0);
+    tour.insert(tour.end(), order.begin(), order.end());
+    tour.push_back(0);
+    rounds = 0;
+
+    // Nothing to reorder with fewer than three stops (2-opt on two stops is
+    // just the same tour backwards)
+    if (order.size() >= 3)
+    {
+        localSearch(tour, deadline);
+        rounds++;
+
+        // Each round anneals from the best tour so far, so the tour in hand
+        // is always at least as good as anything found before it
+        if (options.annealing && options.maxIterations > 0)
+        {
+            vector<int> best(tour);
+            double bestCost = closedTourCost(best);
+            for (int r = 0; r < maxAnnealRounds && chrono::steady_clock::now() < deadline; r++)
+            {
+                anneal(tour, options, random, deadline);
+                localSearch(tour, deadline);
+                rounds++;
+
+                double roundCost = closedTourCost(tour);
+                if (roundCost < bestCost - MIN_GAIN)
+                {
+                    best = tour;
+                    bestCost = roundCost;
+                }
+                else
+                {
+                    tour = best;
+                }
+            }
+        }
+    }
+
+    order.assign(tour.begin() + 1, tour.end() - 1);
+
+    // A tour costs the same both ways round, apart from rounding, so the
+    // annealing's luck decides which way it comes out
+    return settleDirection(order);
+}
+
+double TourOptimizer::closedTourCost(const vector<int>& tour) const
+{
+    double total = 0;
+    for (size_t k = 0; k + 1 < tour.size(); k++)
+        total += cost(tour[k], tour[k+1]);
+    return total;
+}
+
+double TourOptimizer::solveExact(vector<int>& order, ThreadPool* pool,
+                                 chrono::steady_clock::time_point deadline) const
+{
+    int m = m_n - 1;
+    if (m < 3)
+    {
+        order.clear();
+        for (int s = 1; s <= m; s++)
+            order.push_back(s);
+        return settleDirection(order);
+    }
+
+    // Stop s is bit s-1. best[mask*m + j] is the cheapest way to leave the
+    // depot, visit exactly the stops in mask and end at stop j+1, so the
+    // entries for one mask sit together and a whole row is read at once.
+    // legTo[j*m + k] is the cost from stop k+1 to stop j+1, laid out so the
+    // inner loop below walks both arrays in step.
+    uint32_t full = (1u << m) - 1;
+    vector<double> best(static_cast<size_t>(full + 1) * m, numeric_limits<double>::infinity());
+    vector<double> legTo(m * m);
+    for (int j = 0; j < m; j++)
+    {
+        best[(1u << j) * m + j] = cost(0, j + 1);
+        for (int k = 0; k < m; k++)
+            legTo[j * m + k] = cost(k + 1, j + 1);
+    }
+
+    // The cheapest predecessor k of j when the tour has visited mask
+    auto cheapestBefore = [&](uint32_t mask, int j, int& before)
+    {
+        uint32_t prev = mask & ~(1u << j);
+        const double* row = &best[static_cast<size_t>(prev) * m];
+        const double* legs = &legTo[j * m];
+        double cheapest = numeric_limits<double>::infinity();
+        for (int k = 0; k < m; k++)
+        {
+            if ((prev >> k & 1) && row[k] + legs[k] < cheapest)
+            {
+                cheapest = row[k] + legs[k];
+                before = k;
+            }
+        }
+        return cheapest;
+    };
+
+    auto fill = [&](uint32_t mask)
+    {
+        int before;
+        for (int j = 0; j < m; j++)
+        {
+            if (mask >> j & 1)
+                best[static_cast<size_t>(mask) * m + j] = cheapestBefore(mask, j, before);
+        }
+    };
+
+    // Fill in layer[begin] .. layer[end-1], giving up once the first
+    // thread to look at the clock sees the deadline has passed
+    bool timed = deadline != chrono::steady_clock::time_point::max();
+    atomic<bool> expired(false);
+    vector<uint32_t> layer;
+    auto fillRange = [&](int begin, int end)
+    {
+        for (int i = begin; i < end && !expired; i++)
+        {
+            if (timed && (i - begin) % CLOCK_CHECK_INTERVAL == 0 && chrono::steady_clock::now() >= deadline)
+                expired = true;
+            else
+                fill(layer[i]);
+        }
+    };
+
+    // Each subset depends only on smaller ones, so all the subsets of one
+    // size can be filled in at once
+    for (int size = 2; size <= m; size++)
+    {
+        // Every mask with size bits set, in increasing order
+        layer.clear();
+        uint32_t mask = (1u << size) - 1;
+        while (mask <= full)
+        {
+            layer.push_back(mask);
+            uint32_t low = mask & (0u - mask);
+            uint32_t ripple = mask + low;
+            mask = ripple | (((mask ^ ripple) >> 2) / low);
+        }
+
+        int nLayer = static_cast<int>(layer.size());
+        if (pool != nullptr && static_cast<long>(nLayer) * m * m >= PARALLEL_LAYER_WORK)
+        {
+            int nChunks = pool->size() * 4;
+            pool->run(nChunks, [&](int chunk, int)
+            {
+                int begin = static_cast<int>(static_cast<long>(nLayer) * chunk / nChunks);
+                int end = static_cast<int>(static_cast<long>(nLayer) * (chunk + 1) / nChunks);
+                fillRange(begin, end);
+            });
+        }
+        else
+        {
+            fillRange(0, nLayer);
+        }
+
+        if (expired)
+            return numeric_limits<double>::infinity();
+    }
+
+    // Close the tour, then follow the predecessors back from its last stop
+    int last = 0;
+    double cheapest = numeric_limits<double>::infinity();
+    for (int j = 0; j < m; j++)
+    {
+        double total = best[static_cast<size_t>(full) * m + j] + cost(j + 1, 0);
+        if (total < cheapest)
+        {
+            cheapest = total;
+            last = j;
+        }
+    }
+
+    order.clear();
+    uint32_t mask = full;
+    for (int j = last; ; )
+    {
+        order.push_back(j + 1);
+        if (mask == (1u << j))
+            break;
+        int before = 0;
+        cheapestBefore(mask, j, before);
+        mask &= ~(1u << j);
+        j = before;
+    }
+    reverse(order.begin(), order.end());
+
+    return settleDirection(order);
+}
+
+double TourOptimizer::exactSeconds(int nStops)
+{
+    return ldexp(1.0, nStops) * nStops * nStops / EXACT_STEPS_PER_SECOND;
+}
+
+double TourOptimizer::settleDirection(vector<int>& order) const
+{
+    vector<int> backwards(order.rbegin(), order.rend());
+    double forwardCost = tourCost(order);
+    double backwardCost = tourCost(backwards);
+    if (backwardCost < forwardCost - MIN_GAIN ||
+        (backwardCost <= forwardCost + MIN_GAIN && !order.empty() && order.back() < order.front()))
+    {
+        order.swap(backwards);
+        return backwardCost;
+    }
+    return forwardCost;
+}
+
+double TourOptimizer::twoOptDelta(const vector<int>& tour, int i, int j) const
+{
+    // Reversing tour[i..j] swaps legs a-b and c-d for a-c and b-d
+    int a = tour[i-1], b = tour[i], c = tour[j], d = tour[j+1];
+    return cost(a, c) + cost(b, d) - cost(a, b) - cost(c, d);
+}
+
+double TourOptimizer::orOptDelta(const vector<int>& tour, int i, int len, int p, bool reversed) const
+{
+    // Lift tour[i..i+len-1] out from between a and b, and put it between
+    // c = tour[p] and d = tour[p+1]
+    int a = tour[i-1], first = tour[i], last = tour[i+len-1], b = tour[i+len];
+    int c = tour[p], d = tour[p+1];
+    double removed = cost(a, b) - cost(a, first) - cost(last, b);
+    double inserted = reversed ? cost(c, last) + cost(first, d) - cost(c, d)
+                               : cost(c, first) + cost(last, d) - cost(c, d);
+    return removed + inserted;
+}
+
+void TourOptimizer::applyOrOpt(vector<int>& tour, int i, int len, int p, bool reversed) const
+{
+    int start;
+    if (p > i)
+    {
+        rotate(tour.begin() + i, tour.begin() + i + len, tour.begin() + p + 1);
+        start = p + 1 - len;
+    }
+    else
+    {
+        rotate(tour.begin() + p + 1, tour.begin() + i, tour.begin() + i + len);
+        start = p + 1;
+    }
+    if (reversed)
+        reverse(tour.begin() + start, tour.begin() + start + len);
+}
+
+void TourOptimizer::localSearch(vector<int>& tour, chrono::steady_clock::time_point deadline) const
+{
+    while (chrono::steady_clock::now() < deadline &&
+           (improveTwoOpt(tour) || improveOrOpt(tour)))
+        ;
+}
+
+bool TourOptimizer::improveTwoOpt(vector<int>& tour) const
+{
+    int last = static_cast<int>(tour.size()) - 2;     // position of the last stop
+    for (int i = 1; i < last; i++)
+    {
+        for (int j = i + 1; j <= last; j++)
+        {
+            if (twoOptDelta(tour, i, j) < -MIN_GAIN)
+            {
+                reverse(tour.begin() + i, tour.begin() + j + 1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool TourOptimizer::improveOrOpt(vector<int>& tour) const
+{
+    int last = static_cast<int>(tour.size()) - 2;
+    for (int len = 1; len <= MAX_OR_OPT_RUN && len < last; len++)
+    {
+        for (int i = 1; i + len - 1 <= last; i++)
+        {
+            // Any gap outside the run and not right next to it; p is the
+            // position just before the gap
+            for (int p = 0; p <= last; p++)
+            {
+                if (p >= i - 1 && p <= i + len - 1)
+                    continue;
+                for (int r = 0; r < 2; r++)
+                {
+                    // A lone stop reads the same either way round
+                    if (r == 1 && len == 1)
+                        break;
+                    if (orOptDelta(tour, i, len, p, r == 1) < -MIN_GAIN)
+                    {
+                        applyOrOpt(tour, i, len, p, r == 1);
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+vector<int> TourOptimizer::nearestStops(int k) const
+{
+    vector<int> near;
+    vector<int> others;
+    k = min(k, m_n - 2);
+    for (int s = 0; s < m_n; s++)
+    {
+        others.clear();
+        for (int t = 1; t < m_n; t++)
+        {
+            if (t != s)
+                others.push_back(t);
+        }
+        partial_sort(others.begin(), others.begin() + k, others.end(),
+                     [this, s](int a, int b) { return cost(s, a) < cost(s, b); });
+        near.insert(near.end(), others.begin(), others.begin() + k);
+    }
+    return near;
+}
+
+void TourOptimizer::anneal(vector<int>& tour, const OptimizerOptions& options,
+                           const function<int(int, int)>& random,
+                           chrono::steady_clock::time_point deadline) const
+{
+    int last = static_cast<int>(tour.size()) - 2;
+    vector<int> best(tour);
+    double current = closedTourCost(tour);
+    double bestCost = current;
+
+    // Moves chosen at random across the whole tour almost always tear it
+    // apart, so instead each one joins a stop to one of its nearest stops
+    int k = min(NEIGHBOURS, m_n - 2);
+    vector<int> near = nearestStops(k);
+    vector<int> position(m_n);
+    for (int i = 1; i <= last; i++)
+        position[tour[i]] = i;
+
+    // Scale the temperature to the legs of this tour, and cool it from
+    // START_TEMPERATURE to END_TEMPERATURE over the iterations allowed
+    double averageLeg = current / (last + 1);
+    double temperature = START_TEMPERATURE * averageLeg;
+    double cooling = pow(END_TEMPERATURE / START_TEMPERATURE, 1.0 / options.maxIterations);
+    const int RESOLUTION = 1 << 30;
+
+    for (int iter = 0; iter < options.maxIterations; iter++, temperature *= cooling)
+    {
+        if (iter % CLOCK_CHECK_INTERVAL == 0 && chrono::steady_clock::now() >= deadline)
+            break;
+
+        // Pick a stop a and one of its neighbours c
+        int i = random(1, last);
+        int a = tour[i];
+        int c = near[a * k + random(0, k - 1)];
+        int j = position[c];
+
+        // Either make c follow a with a 2-opt move, or move a run of stops
+        // starting at a to just after c with an Or-opt move
+        bool twoOpt = random(0, 1) == 0;
+        int from, to, len = 0;
+        bool reversed = false;
+        double delta;
+        if (twoOpt)
+        {
+            if (i > j)
+                from = j + 1, to = i;
+            else
+                from = i + 1, to = j;
+            if (from >= to)
+                continue;
+            delta = twoOptDelta(tour, from, to);
+        }
+        else
+        {
+            len = random(1, min(MAX_OR_OPT_RUN, last - 1));
+            from = i;
+            to = j;
+            if (from + len - 1 > last || (to >= from - 1 && to <= from + len - 1))
+                continue;
+            reversed = len > 1 && random(0, 1) == 1;
+            delta = orOptDelta(tour, from, len, to, reversed);
+        }
+
+        if (delta >= 0 &&
+            random(0, RESOLUTION - 1) >= exp(-delta / temperature) * RESOLUTION)
+            continue;
+
+        int changedFrom, changedTo;
+        if (twoOpt)
+        {
+            reverse(tour.begin() + from, tour.begin() + to + 1);
+            changedFrom = from;
+            changedTo = to;
+        }
+        else
+        {
+            applyOrOpt(tour, from, len, to, reversed);
+            changedFrom = min(from, to + 1);
+            changedTo = max(from + len - 1, to);
+        }
+        for (int q = changedFrom; q <= changedTo; q++)
+            position[tour[q]] = q;
+        current += delta;
+
+        if (current < bestCost - MIN_GAIN)
+        {
+            bestCost = current;
+            best = tour;
+        }
+    }
+
+    tour.swap(best);
+}
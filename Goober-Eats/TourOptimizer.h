@@ -0,0 +1,134 @@
+//
+//  TourOptimizer.h
+//  Goober-Eats
+//
+
+#ifndef TourOptimizer_h
+#define TourOptimizer_h
+
+#include "provided.h"
+#include <vector>
+#include <functional>
+#include <chrono>
+
+class ThreadPool;
+
+// Orders the stops of a delivery tour given the cost of travelling between
+// every pair of them, such as a DistanceMatrix's street distances. Stop 0
+// is the depot, which every tour leaves from and returns to.
+//
+// optimize() improves a tour with two kinds of move: 2-opt, which reverses
+// a stretch of the tour, and Or-opt, which moves a run of up to three stops
+// elsewhere, either way round. Each move changes only a handful of legs,
+// so its effect on the tour's cost is worked out from those legs alone.
+// Streets go both ways with the same length, so the costs are taken as
+// symmetric and a reversed stretch costs what it did before.
+//
+// Moves that shorten the tour are taken until none is left (a local
+// optimum). With annealing, optimize() then wanders from there with random
+// moves, each joining a stop to one of its nearest stops. It sometimes
+// takes ones that lengthen the tour so as to escape the local optimum, less
+// and less willingly as it cools, and finally polishes the best tour it saw.
+//
+// For small tours, solveExact() finds the true optimum instead, by dynamic
+// programming over subsets of the stops (Held-Karp). The table holds the
+// cheapest way to leave the depot, visit each subset and end at each stop
+// in it, so it grows as 2^n and is only affordable for a dozen or so.
+
+class TourOptimizer
+{
+public:
+    // Stands in for the cost of a leg with no route, so that tours avoid
+    // such legs while the arithmetic stays finite
+    static constexpr double UNREACHABLE_COST = 1e9;
+
+    // The most stops besides the depot solveExact() will take on. Its table
+    // holds 2^n * n doubles, 8 MB at this many stops.
+    static const int MAX_EXACT_STOPS = 16;
+
+    // Moves must gain more than this, so that rounding differences between
+    // the two directions of a leg can't make two tours flip back and forth.
+    // The other local searches over costs between stops use it too.
+    static constexpr double MIN_GAIN = 1e-9;
+
+    // cost holds n*n entries; cost[i*n + j] is the cost from stop i to j
+    TourOptimizer(const std::vector<double>& cost, int n);
+
+    // A visiting order of stops 1 .. n-1 that always goes on to the nearest
+    // stop not yet visited
+    std::vector<int> nearestNeighbourOrder() const;
+
+    // Improve order, a visiting order of stops 1 .. n-1, within the budget
+    // in options. random(lo, hi) returns a uniformly distributed int from lo
+    // to hi, inclusive; it is only called when annealing. Returns the cost
+    // of the tour from the depot through order and back.
+    double optimize(std::vector<int>& order, const OptimizerOptions& options,
+                    const std::function<int(int, int)>& random) const;
+
+    // Anytime version of optimize(): rather than one round of annealing, it
+    // runs round after round, each from the best tour so far, until
+    // deadline (options.maxSeconds is ignored). rounds counts the rounds
+    // that ran, the first being the initial 2-opt and Or-opt descent.
+    double optimizeUntil(std::vector<int>& order, const OptimizerOptions& options,
+                         std::chrono::steady_clock::time_point deadline,
+                         const std::function<int(int, int)>& random, int& rounds) const;
+
+    // Set order to the best visiting order of stops 1 .. n-1, where n-1 is
+    // at most MAX_EXACT_STOPS. With a pool, each layer of the table (every
+    // subset of one size) is split across its threads once it is big
+    // enough to be worth it. Returns the cost of the tour, or infinity,
+    // leaving order alone, if deadline passes before the table is filled.
+    double solveExact(std::vector<int>& order, ThreadPool* pool = nullptr,
+                      std::chrono::steady_clock::time_point deadline =
+                          std::chrono::steady_clock::time_point::max()) const;
+
+    // Roughly how many seconds solveExact() takes on one thread for
+    // nStops stops, erring on the slow side, for callers with a time limit
+    // to tell whether it's worth trying
+    static double exactSeconds(int nStops);
+
+    // Cost of the tour from the depot through order and back
+    double tourCost(const std::vector<int>& order) const;
+
+private:
+    std::vector<double> m_cost;
+    int m_n;
+
+    double cost(int from, int to) const { return m_cost[from * m_n + to]; }
+
+    // Turn order round if that's cheaper, or if it costs the same and puts
+    // the lower-numbered stop first, so that equally good answers always
+    // come out the same way round. Returns the cost of the tour.
+    double settleDirection(std::vector<int>& order) const;
+
+    // These work on a whole tour: the depot, the stops, then the depot again
+
+    double closedTourCost(const std::vector<int>& tour) const;
+
+    double twoOptDelta(const std::vector<int>& tour, int i, int j) const;
+    double orOptDelta(const std::vector<int>& tour, int i, int len, int p, bool reversed) const;
+    void applyOrOpt(std::vector<int>& tour, int i, int len, int p, bool reversed) const;
+
+    double improve(std::vector<int>& order, const OptimizerOptions& options,
+                   const std::function<int(int, int)>& random,
+                   std::chrono::steady_clock::time_point deadline,
+                   int maxAnnealRounds, int& rounds) const;
+
+    // Take improving moves until there are none or time is up
+    void localSearch(std::vector<int>& tour, std::chrono::steady_clock::time_point deadline) const;
+
+    // Take the first improving 2-opt or Or-opt move found; false at a
+    // local optimum
+    bool improveTwoOpt(std::vector<int>& tour) const;
+    bool improveOrOpt(std::vector<int>& tour) const;
+
+    // The k nearest stops other than the depot to each stop s are
+    // [s*k, (s+1)*k)
+    std::vector<int> nearestStops(int k) const;
+
+    void anneal(std::vector<int>& tour, const OptimizerOptions& options,
+                const std::function<int(int, int)>& random,
+                std::chrono::steady_clock::time_point deadline) const;
+};
+
+#endif /* TourOptimizer_h */
@@ -0,0 +1,54 @@
+#include "TravelTimes.h"
+#include "StreetGraph.h"
+
+using namespace std;
+
+namespace
+{
+    // Typical speeds by kind of street, in miles per hour
+    struct StreetClass
+    {
+        const char* word;
+        double mph;
+    };
+
+    const StreetClass STREET_CLASSES[] = {
+        {"Freeway", 55}, {"Highway", 45}, {"Expressway", 45}, {"Parkway", 35},
+        {"Boulevard", 35}, {"Avenue", 30}, {"Road", 30}, {"Street", 25},
+        {"Drive", 25}, {"Way", 25}, {"Trail", 20}, {"Place", 20}, {"Lane", 20},
+        {"Terrace", 20}, {"Court", 15}, {"Circle", 15}, {"Driveway", 10},
+        {"Plaza", 10}, {"Walk", 3},
+    };
+}
+
+TravelTimes::TravelTimes(const StreetGraph* g, const ScheduleOptions& options)
+{
+    m_streetMph.assign(g->streetCount(), options.defaultMph);
+    for (int street = 0; street < g->streetCount(); street++)
+    {
+        string name = g->streetName(street);
+        if (options.byStreetClass)
+            m_streetMph[street] = classMph(name, options.defaultMph);
+        for (const auto& named : options.streetMph)
+        {
+            if (named.first == name)
+                m_streetMph[street] = named.second;
+        }
+    }
+
+    m_edgeMinutes.resize(g->edgeCount());
+    for (int e = 0; e < g->edgeCount(); e++)
+        m_edgeMinutes[e] = g->edgeLength(e) / m_streetMph[g->edgeStreet(e)] * 60;
+}
+
+double TravelTimes::classMph(const string& name, double defaultMph)
+{
+    size_t space = name.find_last_of(' ');
+    string word = space == string::npos ? name : name.substr(space + 1);
+    for (const StreetClass& c : STREET_CLASSES)
+    {
+        if (word == c.word)
+            return c.mph;
+    }
+    return defaultMph;
+}
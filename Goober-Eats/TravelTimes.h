@@ -0,0 +1,37 @@
+//
+//  TravelTimes.h
+//  Goober-Eats
+//
+
+#ifndef TravelTimes_h
+#define TravelTimes_h
+
+#include "provided.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class StreetGraph;
+
+// Minutes to drive each edge of a StreetGraph, at a speed set per street
+// as a ScheduleOptions describes. The minutes are laid out by edge ID, so
+// they can weigh a DistanceMatrix's searches in place of edge lengths.
+
+class TravelTimes
+{
+public:
+    TravelTimes(const StreetGraph* g, const ScheduleOptions& options);
+
+    const std::vector<double>& edgeMinutes() const { return m_edgeMinutes; }
+    double streetMph(uint32_t street) const { return m_streetMph[street]; }
+
+    // The speed byStreetClass gives a street called name, going by the last
+    // word of it; defaultMph if that word isn't a kind of street it knows
+    static double classMph(const std::string& name, double defaultMph);
+
+private:
+    std::vector<double> m_streetMph;    // by street ID
+    std::vector<double> m_edgeMinutes;  // by edge ID
+};
+
+#endif /* TravelTimes_h */
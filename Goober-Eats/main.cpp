@@ -4,16 +4,250 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "ContractionHierarchy.h"
+#include "Landmarks.h"
+#include "BatchPlanner.h"
+#include "PlannerService.h"
+#include <unistd.h>
 using namespace std;
 
+  // Compile a text map into a binary snapshot once, so later runs can pass
+  // the snapshot in place of mapdata.txt and skip parsing entirely
+int compileMapSnapshot(string mapFile, string snapshotFile)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cout << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    cout.setf(ios::fixed);
+    cout.precision(1);
+    cout << "Parsed " << mapFile << " at " << sm.loadStats().megabytesPerSecond()
+         << " MB/s using " << sm.loadStats().threads << " thread(s)" << endl;
+    if (!sm.saveSnapshot(snapshotFile))
+    {
+        cout << "Unable to write map snapshot " << snapshotFile << endl;
+        return 1;
+    }
+      // Read it back to make sure it maps and its checksum verifies
+    StreetMap check;
+    if (!check.load(snapshotFile))
+    {
+        cout << "Map snapshot " << snapshotFile << " failed verification" << endl;
+        return 1;
+    }
+    cout << "Wrote map snapshot " << snapshotFile << endl;
+    return 0;
+}
+
+  // Contract a map (text or snapshot) for ROUTER_CH routing and save the
+  // hierarchy next to it, where StreetMap::load will find it
+int contractMap(string mapFile)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cout << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    auto startTime = chrono::steady_clock::now();
+    sm.buildHierarchy();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout.setf(ios::fixed);
+    cout.precision(1);
+    cout << "Contracted " << sm.hierarchy()->nodeCount() << " nodes in " << seconds
+         << " s, adding " << sm.hierarchy()->shortcutCount() << " shortcuts" << endl;
+    if (!sm.saveHierarchy(mapFile + ".ch"))
+    {
+        cout << "Unable to write hierarchy " << mapFile << ".ch" << endl;
+        return 1;
+    }
+    cout << "Wrote hierarchy " << mapFile << ".ch" << endl;
+    return 0;
+}
+
+  // Pick landmarks for ROUTER_ALT routing and save them next to the map,
+  // where StreetMap::load will find them
+int landmarkMap(string mapFile, int count)
+{
+    // A map with no landmarks saved next to it would fail every later load
+    if (count < 1)
+    {
+        cout << "Usage: --landmark-map mapdata.txt [count], where count is at least 1" << endl;
+        return 1;
+    }
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cout << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    auto startTime = chrono::steady_clock::now();
+    sm.buildLandmarks(count);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout.setf(ios::fixed);
+    cout.precision(1);
+    cout << "Picked " << sm.landmarks()->count() << " landmarks in " << seconds << " s" << endl;
+    if (!sm.saveLandmarks(mapFile + ".alt"))
+    {
+        cout << "Unable to write landmarks " << mapFile << ".alt" << endl;
+        return 1;
+    }
+    cout << "Wrote landmarks " << mapFile << ".alt" << endl;
+    return 0;
+}
+
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
 bool parseDelivery(string line, string& lat, string& lon, string& item);
 
+  // Plan several deliveries files against one map at once, printing a line
+  // for each and the batch's throughput
+int planBatch(string mapFile, const vector<string>& deliveriesFiles)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cout << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    vector<PlanJob> jobs(deliveriesFiles.size());
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (!loadDeliveryRequests(deliveriesFiles[i], jobs[i].depot, jobs[i].deliveries))
+        {
+            cout << "Unable to load delivery request file " << deliveriesFiles[i] << endl;
+            return 1;
+        }
+    }
+    
+    BatchPlanner bp(&sm);
+    vector<PlanOutcome> outcomes;
+    BatchStats stats;
+    bp.planAll(jobs, outcomes, stats);
+    
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        cout << deliveriesFiles[i] << ": ";
+        if (outcomes[i].result == BAD_COORD)
+            cout << "invalid coordinates";
+        else if (outcomes[i].result == NO_ROUTE)
+            cout << "no route";
+        else
+            cout << outcomes[i].distance << " miles, " << outcomes[i].commands.size() << " commands";
+        cout << " (" << outcomes[i].seconds * 1000 << " ms)" << endl;
+    }
+    cout << stats.succeeded << " of " << stats.jobs << " plans succeeded in " << stats.seconds
+         << " s on " << stats.threads << " thread(s): " << stats.jobsPerSecond() << " plans/s, "
+         << stats.meanJobSeconds * 1000 << " ms mean, " << stats.maxJobSeconds * 1000 << " ms max" << endl;
+    return stats.succeeded == stats.jobs ? 0 : 1;
+}
+
+  // Keep the map loaded and answer PlannerService requests, on stdin and
+  // stdout or, given a socket path, on a Unix socket
+int serveMap(string mapFile, string socketPath)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    PlannerService service(&sm);
+    if (socketPath.empty())
+    {
+        service.serve(STDIN_FILENO, STDOUT_FILENO);
+        return 0;
+    }
+    cerr << "Serving " << mapFile << " on " << socketPath << endl;
+    if (!service.serveUnixSocket(socketPath))
+    {
+        cerr << "Unable to listen on " << socketPath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+  // Send a deliveries file to a service started with --serve and print the
+  // plan it sends back; --shutdown stops the service instead
+int requestPlan(string socketPath, string deliveriesFile)
+{
+    PlannerClient client;
+    if (!client.connect(socketPath))
+    {
+        cout << "Unable to connect to " << socketPath << endl;
+        return 1;
+    }
+    if (deliveriesFile == "--shutdown")
+    {
+        client.shutdownService();
+        return 0;
+    }
+    
+    GeoCoord depot;
+    vector<DeliveryRequest> deliveries;
+    if (!loadDeliveryRequests(deliveriesFile, depot, deliveries))
+    {
+        cout << "Unable to load delivery request file " << deliveriesFile << endl;
+        return 1;
+    }
+    
+    DeliveryResult result;
+    vector<string> commands;
+    double totalMiles;
+    double seconds;
+    if (!client.plan(depot, deliveries, result, commands, totalMiles, seconds))
+    {
+        cout << "The planner service didn't answer" << endl;
+        return 1;
+    }
+    if (result == BAD_COORD)
+    {
+        cout << "One or more depot or delivery coordinates are invalid." << endl;
+        return 1;
+    }
+    if (result == NO_ROUTE)
+    {
+        cout << "No route can be found to deliver all items." << endl;
+        return 1;
+    }
+    for (const string& command : commands)
+        cout << command << endl;
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    cout << totalMiles << " miles travelled for all deliveries, planned in "
+         << seconds * 1000 << " ms." << endl;
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc == 4 && string(argv[1]) == "--compile-map")
+        return compileMapSnapshot(argv[2], argv[3]);
+    if (argc == 3 && string(argv[1]) == "--contract-map")
+        return contractMap(argv[2]);
+    if ((argc == 3 || argc == 4) && string(argv[1]) == "--landmark-map")
+        return landmarkMap(argv[2], argc == 4 ? atoi(argv[3]) : 16);
+    if (argc >= 4 && string(argv[1]) == "--batch")
+        return planBatch(argv[2], vector<string>(argv + 3, argv + argc));
+    if ((argc == 3 || argc == 4) && string(argv[1]) == "--serve")
+        return serveMap(argv[2], argc == 4 ? argv[3] : "");
+    if (argc == 4 && string(argv[1]) == "--client")
+        return requestPlan(argv[2], argv[3]);
+    
     if (argc != 3)
     {
         cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt" << endl;
+        cout << "       " << argv[0] << " --compile-map mapdata.txt mapdata.snapshot" << endl;
+        cout << "       " << argv[0] << " --contract-map mapdata.txt" << endl;
+        cout << "       " << argv[0] << " --landmark-map mapdata.txt [count]" << endl;
+        cout << "       " << argv[0] << " --batch mapdata.txt deliveries.txt..." << endl;
+        cout << "       " << argv[0] << " --serve mapdata.txt [socket]" << endl;
+        cout << "       " << argv[0] << " --client socket deliveries.txt|--shutdown" << endl;
         return 1;
     }
     
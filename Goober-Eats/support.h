@@ -10,6 +10,7 @@
 #define support_h
 
 #include <climits>
+#include "provided.h"
 
 struct Score
 {
@@ -18,11 +19,38 @@ struct Score
     Score(double score=INT_MAX) : score(score) {}
 };
 
+inline
 bool operator<(const Score& lhs, const Score& rhs)
 {
     return lhs.score < rhs.score;
 }
 
+  // distanceEarthMiles for a point we only have the latitude and longitude
+  // of; gives exactly the same result as the GeoCoord version
+inline double distanceEarthMiles(double lat1d, double lon1d, double lat2d, double lon2d)
+{
+    static const double earthRadiusKm = 6371.0;
+    const double milesPerKm = 1 / 1.609344;
+    double lat1r = deg2rad(lat1d);
+    double lon1r = deg2rad(lon1d);
+    double lat2r = deg2rad(lat2d);
+    double lon2r = deg2rad(lon2d);
+    double u = std::sin((lat2r - lat1r) / 2);
+    double v = std::sin((lon2r - lon1r) / 2);
+    return 2.0 * earthRadiusKm * std::asin(std::sqrt(u * u + std::cos(lat1r) * std::cos(lat2r) * v * v)) * milesPerKm;
+}
+
+  // angleOfLine for the line from (lat1d, lon1d) to (lat2d, lon2d); gives
+  // exactly the same result as the StreetSegment version
+inline double angleOfLine(double lat1d, double lon1d, double lat2d, double lon2d)
+{
+    double result = rad2deg(atan2(lat2d - lat1d, lon2d - lon1d));
+    if (result < 0)
+        result += 360;
+    
+    return result;
+}
+
 
 
 